@@ -0,0 +1,54 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "baked_texture.hpp"
+#include "vendor/stb/stb_image.hpp"
+
+// Decodes an image once, offline, into a file Texture maps and uploads as is:
+//
+//   ./bake [--bc1] <input image> <output.wtex>
+//
+// --bc1 compresses every level to BC1, a sixth of the size of RGBA8, drops alpha.
+
+int main(int argc, char** argv) {
+	BakedFormat format = BakedFormat::RGBA8;
+	const char* files[2] = {};
+	int count = 0;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--bc1"))
+			format = BakedFormat::BC1;
+		else if (count < 2)
+			files[count++] = argv[i];
+		else
+			count = 3;
+	}
+
+	if (count != 2) {
+		fprintf(stderr, "usage: %s [--bc1] <input image> <output.wtex>\n", argv[0]);
+		return 1;
+	}
+
+	// the same orientation as Texture gives a decoded image
+	stbi_set_flip_vertically_on_load(true);
+
+	int width, height, channels;
+	stbi_uc* pixels = stbi_load(files[0], &width, &height, &channels, 4);
+
+	if (!pixels) {
+		fprintf(stderr, "could not read %s: %s\n", files[0], stbi_failure_reason());
+		return 1;
+	}
+
+	bool baked = bake_texture(files[1], width, height, pixels, format);
+	stbi_image_free(pixels);
+
+	if (!baked) {
+		fprintf(stderr, "could not write %s\n", files[1]);
+		return 1;
+	}
+
+	printf("%s: %dx%d %s\n", files[1], width, height, format == BakedFormat::BC1 ? "BC1" : "RGBA8");
+
+	return 0;
+}
@@ -0,0 +1,315 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "mipmap.hpp"
+
+// Textures decoded, mipmapped and optionally compressed ahead of time, see
+// bake.cpp. A file is a header, a table with one entry per mip level, and the
+// levels packed after it each on a 16 byte boundary, exactly as they are
+// handed to OpenGL: rows bottom to top, RGBA8 or BC1 blocks.
+//
+//   BakedHeader | BakedLevel[levels] | level 0 | level 1 | ...
+
+enum class BakedFormat : uint32_t {
+	RGBA8 = 0,
+	// 4x4 blocks of 8 bytes, two RGB565 endpoints and 2 bit indices, no alpha
+	BC1 = 1,
+};
+
+struct BakedHeader {
+	char magic[4];
+	uint32_t version;
+	BakedFormat format;
+	uint32_t width, height;
+	uint32_t levels;
+};
+
+struct BakedLevel {
+	uint32_t width, height;
+	uint64_t offset, size;
+};
+
+static constexpr char BAKED_MAGIC[4] = {'W', 'T', 'E', 'X'};
+static constexpr uint32_t BAKED_VERSION = 1;
+
+// Bytes of one level in a format
+inline uint64_t baked_level_size(BakedFormat format, uint32_t width, uint32_t height) {
+	if (format == BakedFormat::BC1)
+		return (uint64_t)((width + 3) / 4) * ((height + 3) / 4) * 8;
+
+	return (uint64_t)width * height * 4;
+}
+
+inline uint16_t rgb565(const uint8_t* color) {
+	return (color[0] >> 3) << 11 | (color[1] >> 2) << 5 | color[2] >> 3;
+}
+
+inline void rgb888(uint16_t color, uint8_t* out) {
+	out[0] = (color >> 11 & 31) * 255 / 31;
+	out[1] = (color >> 5 & 63) * 255 / 63;
+	out[2] = (color & 31) * 255 / 31;
+	out[3] = 255;
+}
+
+// The four colours of a block, from its two endpoints, in four-colour mode
+inline void bc1_palette(uint16_t c0, uint16_t c1, uint8_t palette[4][4]) {
+	rgb888(c0, palette[0]);
+	rgb888(c1, palette[1]);
+
+	for (int channel = 0; channel < 4; channel++) {
+		palette[2][channel] = (2 * palette[0][channel] + palette[1][channel] + 1) / 3;
+		palette[3][channel] = (palette[0][channel] + 2 * palette[1][channel] + 1) / 3;
+	}
+}
+
+// Endpoints from the bounding box of the block's colours, pulled in by a
+// sixteenth as the extremes are rarely worth an exact match, then every
+// texel takes its nearest palette entry
+inline void bc1_encode_block(const uint8_t texels[16][4], uint8_t* block) {
+	uint8_t low[3] = {255, 255, 255};
+	uint8_t high[3] = {0, 0, 0};
+
+	for (int i = 0; i < 16; i++) {
+		for (int channel = 0; channel < 3; channel++) {
+			low[channel] = std::min(low[channel], texels[i][channel]);
+			high[channel] = std::max(high[channel], texels[i][channel]);
+		}
+	}
+
+	uint8_t end[2][3];
+
+	for (int channel = 0; channel < 3; channel++) {
+		const int inset = (high[channel] - low[channel]) / 16;
+		end[0][channel] = high[channel] - inset;
+		end[1][channel] = low[channel] + inset;
+	}
+
+	uint16_t c0 = rgb565(end[0]);
+	uint16_t c1 = rgb565(end[1]);
+
+	// c0 > c1 selects four colours, equal endpoints can only be one colour anyway
+	if (c0 < c1)
+		std::swap(c0, c1);
+
+	uint8_t palette[4][4];
+	bc1_palette(c0, c1, palette);
+
+	uint32_t indices = 0;
+
+	for (int i = 0; i < 16; i++) {
+		int best = 0;
+		int best_distance = 1 << 30;
+
+		for (int p = 0; p < (c0 == c1 ? 1 : 4); p++) {
+			int distance = 0;
+
+			for (int channel = 0; channel < 3; channel++) {
+				int difference = texels[i][channel] - palette[p][channel];
+				distance += difference * difference;
+			}
+
+			if (distance < best_distance) {
+				best_distance = distance;
+				best = p;
+			}
+		}
+
+		indices |= (uint32_t)best << (2 * i);
+	}
+
+	memcpy(block, &c0, 2);
+	memcpy(block + 2, &c1, 2);
+	memcpy(block + 4, &indices, 4);
+}
+
+inline std::vector<uint8_t> bc1_encode(const MipLevel& level) {
+	const int columns = (level.width + 3) / 4;
+	const int rows = (level.height + 3) / 4;
+
+	std::vector<uint8_t> blocks((size_t)columns * rows * 8);
+
+	for (int by = 0; by < rows; by++) {
+		for (int bx = 0; bx < columns; bx++) {
+			uint8_t texels[16][4];
+
+			// blocks over the edge repeat the last row and column
+			for (int i = 0; i < 16; i++) {
+				const int x = std::min(bx * 4 + i % 4, level.width - 1);
+				const int y = std::min(by * 4 + i / 4, level.height - 1);
+				memcpy(texels[i], &level.pixels[((size_t)y * level.width + x) * 4], 4);
+			}
+
+			bc1_encode_block(texels, &blocks[((size_t)by * columns + bx) * 8]);
+		}
+	}
+
+	return blocks;
+}
+
+// For drivers without S3TC, back to RGBA8
+inline std::vector<uint8_t> bc1_decode(const uint8_t* blocks, uint32_t width, uint32_t height) {
+	const uint32_t columns = (width + 3) / 4;
+	std::vector<uint8_t> pixels((size_t)width * height * 4);
+
+	for (uint32_t y = 0; y < height; y++) {
+		for (uint32_t x = 0; x < width; x++) {
+			const uint8_t* block = blocks + ((size_t)(y / 4) * columns + x / 4) * 8;
+
+			uint16_t c0, c1;
+			uint32_t indices;
+			memcpy(&c0, block, 2);
+			memcpy(&c1, block + 2, 2);
+			memcpy(&indices, block + 4, 4);
+
+			uint8_t palette[4][4];
+			bc1_palette(c0, c1, palette);
+
+			const int index = indices >> (2 * ((y % 4) * 4 + x % 4)) & 3;
+			memcpy(&pixels[((size_t)y * width + x) * 4], palette[index], 4);
+		}
+	}
+
+	return pixels;
+}
+
+// Writes an RGBA8 image, bottom row first, and its mip chain to path
+inline bool bake_texture(const char* path, int width, int height, const uint8_t* pixels, BakedFormat format) {
+	std::vector<MipLevel> chain = mip_chain(width, height, pixels);
+
+	BakedHeader header = {};
+	memcpy(header.magic, BAKED_MAGIC, sizeof(header.magic));
+	header.version = BAKED_VERSION;
+	header.format = format;
+	header.width = width;
+	header.height = height;
+	header.levels = chain.size();
+
+	std::vector<BakedLevel> table(chain.size());
+	std::vector<std::vector<uint8_t>> payloads(chain.size());
+
+	uint64_t offset = sizeof(BakedHeader) + table.size() * sizeof(BakedLevel);
+
+	for (size_t i = 0; i < chain.size(); i++) {
+		payloads[i] = format == BakedFormat::BC1 ? bc1_encode(chain[i]) : std::move(chain[i].pixels);
+
+		offset = (offset + 15) & ~uint64_t(15);
+		table[i] = {(uint32_t)chain[i].width, (uint32_t)chain[i].height, offset, payloads[i].size()};
+		offset += payloads[i].size();
+	}
+
+	FILE* file = fopen(path, "wb");
+
+	if (!file)
+		return false;
+
+	bool written = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(table.data(), sizeof(BakedLevel), table.size(), file) == table.size();
+
+	uint64_t position = sizeof(BakedHeader) + table.size() * sizeof(BakedLevel);
+
+	for (size_t i = 0; i < payloads.size() && written; i++) {
+		static const uint8_t zeros[16] = {};
+		const size_t padding = table[i].offset - position;
+
+		written = fwrite(zeros, 1, padding, file) == padding && fwrite(payloads[i].data(), 1, payloads[i].size(), file) == payloads[i].size();
+		position = table[i].offset + payloads[i].size();
+	}
+
+	return fclose(file) == 0 && written;
+}
+
+// A baked file mapped read only, the levels point straight into the mapping
+struct BakedTexture {
+
+	BakedTexture(const char* path) {
+		int descriptor = open(path, O_RDONLY | O_CLOEXEC);
+
+		if (descriptor < 0)
+			return;
+
+		struct stat info;
+
+		if (fstat(descriptor, &info) == 0 && info.st_size >= (off_t)sizeof(BakedHeader)) {
+			size = info.st_size;
+			mapping = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, descriptor, 0);
+
+			if (mapping == MAP_FAILED)
+				mapping = nullptr;
+		}
+
+		// the mapping stays valid without the descriptor
+		close(descriptor);
+
+		if (mapping && !validate()) {
+			munmap(mapping, size);
+			mapping = nullptr;
+		}
+	}
+
+	~BakedTexture() {
+		if (mapping)
+			munmap(mapping, size);
+	}
+
+	BakedTexture(const BakedTexture&) = delete;
+	BakedTexture& operator=(const BakedTexture&) = delete;
+
+	// Mapped and every level inside the file
+	bool valid() const {
+		return mapping != nullptr;
+	}
+
+	const BakedHeader& header() const {
+		return *(const BakedHeader*)mapping;
+	}
+
+	const BakedLevel& level(uint32_t index) const {
+		return ((const BakedLevel*)((const uint8_t*)mapping + sizeof(BakedHeader)))[index];
+	}
+
+	const uint8_t* data(uint32_t index) const {
+		return (const uint8_t*)mapping + level(index).offset;
+	}
+
+private:
+	bool validate() {
+		const BakedHeader& head = header();
+
+		if (memcmp(head.magic, BAKED_MAGIC, sizeof(head.magic)) || head.version != BAKED_VERSION)
+			return false;
+
+		if (head.format != BakedFormat::RGBA8 && head.format != BakedFormat::BC1)
+			return false;
+
+		if (!head.levels || head.levels > 32 || sizeof(BakedHeader) + head.levels * sizeof(BakedLevel) > size)
+			return false;
+
+		for (uint32_t i = 0; i < head.levels; i++) {
+			const BakedLevel& entry = level(i);
+
+			// each level half the one before, rounded down and never below one
+			const uint32_t width = std::max(1u, head.width >> i);
+			const uint32_t height = std::max(1u, head.height >> i);
+
+			if (entry.width != width || entry.height != height)
+				return false;
+
+			if (entry.size != baked_level_size(head.format, width, height) || entry.offset > size || entry.size > size - entry.offset)
+				return false;
+		}
+
+		return true;
+	}
+
+	void* mapping = nullptr;
+	size_t size = 0;
+};
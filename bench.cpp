@@ -0,0 +1,511 @@
+#include <assert.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "log.hpp"
+#include "shader.hpp"
+#include "mesh.hpp"
+#include "texture.hpp"
+#include "texture_stream.hpp"
+#include "renderer.hpp"
+#include "plane.hpp"
+#include "grid.hpp"
+#include "waves.hpp"
+#include "simd.hpp"
+#include "command_queue.hpp"
+#include "job_system.hpp"
+
+#include "vendor/glm/glm.hpp"
+#include "vendor/glm/gtc/matrix_transform.hpp"
+
+// Hot paths of water timed on their own, headless, with the results as JSON:
+//
+//   ./bench [--filter <substring>] [--out <file>] [--image <file>] [--min-time <seconds>]
+//
+// Every benchmark is run once to warm up, then repeated until it has both
+// MIN_ITERATIONS samples and min-time seconds. The median and p99 of the
+// samples are reported, with the throughput at the median.
+
+const int MIN_ITERATIONS = 10;
+const int MAX_ITERATIONS = 10000;
+
+struct Result {
+	std::string name;
+	std::vector<double> seconds;
+	// work done by one iteration, in unit
+	double work;
+	const char* unit;
+};
+
+struct Bench {
+	const char* filter = nullptr;
+	double min_time = 0.5;
+	std::vector<Result> results;
+
+	bool selected(const char* name) {
+		return !filter || strstr(name, filter);
+	}
+
+	// Times run(), setup() goes before every iteration and is not counted
+	void measure(const char* name, double work, const char* unit, const std::function<void()>& run, const std::function<void()>& setup = nullptr) {
+		if (!selected(name))
+			return;
+
+		Result result = {name, {}, work, unit};
+
+		if (setup)
+			setup();
+
+		run();
+
+		double total = 0.0;
+
+		while ((result.seconds.size() < MIN_ITERATIONS || total < min_time) && result.seconds.size() < MAX_ITERATIONS) {
+			if (setup)
+				setup();
+
+			auto begin = std::chrono::steady_clock::now();
+			run();
+			auto end = std::chrono::steady_clock::now();
+
+			double seconds = std::chrono::duration<double>(end - begin).count();
+			result.seconds.push_back(seconds);
+			total += seconds;
+		}
+
+		fprintf(stderr, "%-24s %10.3f ms median  %zu iterations\n", name, percentile(result.seconds, 0.5) * 1e3, result.seconds.size());
+
+		results.push_back(result);
+	}
+
+	static double percentile(std::vector<double> values, double p) {
+		std::sort(values.begin(), values.end());
+		return values[std::min(values.size() - 1, (size_t)(p * values.size()))];
+	}
+
+	void report(FILE* file) {
+		fprintf(file, "{\n\t\"simd\": \"%s\",\n\t\"benchmarks\": [\n", simd_name(simd_detect()));
+
+		for (size_t i = 0; i < results.size(); i++) {
+			const Result& result = results[i];
+
+			double median = percentile(result.seconds, 0.5);
+			double mean = 0.0;
+
+			for (double seconds : result.seconds)
+				mean += seconds;
+
+			mean /= result.seconds.size();
+
+			fprintf(file, "\t\t{\"name\": \"%s\", \"iterations\": %zu, \"median_ms\": %.6f, \"p99_ms\": %.6f, "
+				"\"mean_ms\": %.6f, \"min_ms\": %.6f, \"throughput\": %.6g, \"unit\": \"%s/s\"}%s\n",
+				result.name.c_str(), result.seconds.size(), median * 1e3, percentile(result.seconds, 0.99) * 1e3,
+				mean * 1e3, percentile(result.seconds, 0.0) * 1e3, result.work / median, result.unit,
+				i + 1 < results.size() ? "," : "");
+		}
+
+		fprintf(file, "\t]\n}\n");
+	}
+};
+
+// A noisy RGB image stb_image can read, for when no --image is given
+static const char* make_image(int size) {
+	static char path[] = "/tmp/water-bench-XXXXXX";
+	int descriptor = mkstemp(path);
+
+	if (descriptor < 0)
+		return nullptr;
+
+	FILE* file = fdopen(descriptor, "wb");
+	fprintf(file, "P6\n%d %d\n255\n", size, size);
+
+	unsigned int state = 1;
+
+	for (int i = 0; i < 3 * size * size; i++) {
+		state = state * 1664525u + 1013904223u;
+		fputc(state >> 24, file);
+	}
+
+	fclose(file);
+
+	return path;
+}
+
+static void bench_plane(Bench& bench) {
+	const double vertices = (SIZE + 1) * (SIZE + 1);
+
+	GridBuilder grid(SIZE);
+	std::vector<uint16_t> cells(2 * grid.vertex_count());
+	std::vector<unsigned int> indices(grid.index_count());
+
+	bench.measure("plane_generation", vertices, "vertices", [&] {
+		grid.write(cells.data(), indices.data());
+	});
+
+	JobSystem jobs;
+	GridBuilder parallel(SIZE, &jobs);
+
+	bench.measure("plane_generation_parallel", vertices, "vertices", [&] {
+		parallel.write(cells.data(), indices.data());
+	});
+
+	bench.measure("plane_strips", vertices, "vertices", [] {
+		generate_plane_strips();
+	});
+}
+
+static void bench_upload(Bench& bench) {
+	GridBuilder grid(SIZE);
+	std::vector<uint16_t> cells(2 * grid.vertex_count());
+	std::vector<unsigned int> indices(grid.index_count());
+	grid.write(cells.data(), indices.data());
+
+	Mesh* mesh = new Mesh();
+	const double bytes = (cells.size() * sizeof(uint16_t) + indices.size() * sizeof(unsigned int));
+
+	// glFinish makes the copy part of the time, not just the call
+	bench.measure("mesh_upload", bytes, "bytes", [&] {
+		mesh->data(cells.size() * sizeof(uint16_t), cells.data(), GL_STATIC_DRAW);
+		mesh->indices(indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+		GL_CALL(glFinish());
+	});
+
+	// generated straight into the mapped buffers, what startup pays
+	JobSystem jobs;
+	const size_t threads[] = {1, jobs.size()};
+	const char* names[] = {"plane_build", "plane_build_parallel"};
+
+	for (int i = 0; i < 2; i++) {
+		GridBuilder builder(SIZE, threads[i] > 1 ? &jobs : nullptr);
+
+		bench.measure(names[i], bytes, "bytes", [&] {
+			builder.build(mesh);
+			GL_CALL(glFinish());
+		});
+	}
+
+	PlaneStrips strips = generate_plane_strips();
+	const double strip_bytes = (strips.cells.size() + strips.indices.size()) * sizeof(uint16_t);
+
+	bench.measure("mesh_upload_strips", strip_bytes, "bytes", [mesh, &strips] {
+		mesh->data(strips.cells.size() * sizeof(uint16_t), strips.cells.data(), GL_STATIC_DRAW);
+		mesh->indices(strips.indices.size() * sizeof(uint16_t), strips.indices.data(), GL_STATIC_DRAW);
+		GL_CALL(glFinish());
+	});
+
+	delete mesh;
+}
+
+static void bench_shaders(Bench& bench) {
+	bench.measure("shader_compile", 1, "programs", [] {
+		Shader* shader = new Shader("plane.vert", "plane.frag");
+		delete shader;
+	});
+
+	bench.measure("shader_compile_tess", 1, "programs", [] {
+		Shader* shader = new Shader("plane.vert", "plane.tesc", "plane.tese", "plane.frag", "#define TESSELLATED\n");
+		delete shader;
+	});
+
+	if (!bench.selected("shader_cached"))
+		return;
+
+	// a cache of its own, the first program is compiled and stored by the warm up
+	char root[] = "/tmp/water-bench-cache-XXXXXX";
+
+	if (!mkdtemp(root))
+		return;
+
+	Shader::cache = new ProgramCache(root);
+
+	if (Shader::cache->enabled()) {
+		bench.measure("shader_cached", 1, "programs", [] {
+			Shader* shader = new Shader("plane.vert", "plane.tesc", "plane.tese", "plane.frag", "#define TESSELLATED\n");
+			delete shader;
+		});
+	}
+
+	delete Shader::cache;
+	Shader::cache = nullptr;
+
+	std::string command = std::string("rm -rf ") + root;
+	system(command.c_str());
+}
+
+static void bench_texture(Bench& bench, const char* path) {
+	int width, height, channels;
+
+	if (!stbi_info(path, &width, &height, &channels)) {
+		fprintf(stderr, "could not read %s\n", path);
+		return;
+	}
+
+	const double pixels = (double)width * height;
+
+	bench.measure("texture_decode", pixels, "pixels", [path] {
+		int width, height, channels;
+		stbi_uc* buffer = stbi_load(path, &width, &height, &channels, 4);
+		stbi_image_free(buffer);
+	});
+
+	bench.measure("texture_load", pixels, "pixels", [path] {
+		Texture* texture = new Texture(path);
+		GL_CALL(glFinish());
+		delete texture;
+	});
+
+	// eight at once with mip chains, decoded as jobs
+	const int STREAMED = 8;
+	JobSystem jobs;
+
+	bench.measure("texture_stream", STREAMED * pixels, "pixels", [path, &jobs] {
+		TextureStream* stream = new TextureStream(&jobs);
+
+		for (int i = 0; i < STREAMED; i++)
+			stream->load(path);
+
+		stream->finish();
+		GL_CALL(glFinish());
+		delete stream;
+	});
+
+	// the same image baked once, then mapped and uploaded with all its levels
+	stbi_set_flip_vertically_on_load(true);
+	stbi_uc* decoded = stbi_load(path, &width, &height, &channels, 4);
+
+	if (!decoded)
+		return;
+
+	const BakedFormat formats[] = {BakedFormat::RGBA8, BakedFormat::BC1};
+	const char* names[] = {"texture_baked", "texture_baked_bc1"};
+
+	for (int i = 0; i < 2; i++) {
+		std::string baked = std::string(path) + (i ? ".bc1.wtex" : ".wtex");
+
+		if (bake_texture(baked.c_str(), width, height, decoded, formats[i])) {
+			bench.measure(names[i], pixels, "pixels", [baked] {
+				Texture* texture = new Texture(baked.c_str());
+				GL_CALL(glFinish());
+				delete texture;
+			});
+		}
+
+		remove(baked.c_str());
+	}
+
+	stbi_image_free(decoded);
+}
+
+static void bench_sort(Bench& bench) {
+	const size_t count = 1 << 16;
+
+	std::vector<CommandQueue::Entry> entries(count), scratch;
+	unsigned int state = 1;
+
+	// 16 programs, 64 vertex arrays and 256 textures over two passes
+	auto shuffle = [&] {
+		for (size_t i = 0; i < count; i++) {
+			state = state * 1664525u + 1013904223u;
+			entries[i] = {CommandList::key(state >> 31, 1 + (state >> 4 & 15), 1 + (state >> 8 & 63), 1 + (state >> 16 & 255)), 0, (uint32_t)i};
+		}
+	};
+
+	bench.measure("command_sort", count, "commands", [&] {
+		CommandQueue::sort(entries, scratch);
+	}, shuffle);
+}
+
+// Overhead of the job system, empty jobs so only the scheduling is timed
+static void bench_jobs(Bench& bench) {
+	const size_t JOBS = 4096;
+	const size_t STAGES = 64;
+
+	JobSystem jobs;
+
+	bench.measure("jobs_run", JOBS, "jobs", [&] {
+		JobCounter counter;
+
+		for (size_t i = 0; i < JOBS; i++)
+			jobs.run([] {}, &counter);
+
+		jobs.wait(counter);
+	});
+
+	// stages that each start once the one before is done
+	bench.measure("jobs_dependencies", JOBS, "jobs", [&] {
+		std::vector<JobCounter> stages(STAGES);
+
+		for (size_t stage = 0; stage < STAGES; stage++) {
+			for (size_t i = 0; i < JOBS / STAGES; i++)
+				jobs.run([] {}, &stages[stage], stage ? &stages[stage - 1] : nullptr);
+		}
+
+		jobs.wait(stages.back());
+	});
+
+	bench.measure("jobs_parallel_for", JOBS, "items", [&] {
+		jobs.parallel_for(JOBS, 1, [](size_t, size_t) {});
+	});
+}
+
+// Small draws over a few meshes and programs, recorded in shuffled order by
+// every thread of the job system and submitted sorted
+static void bench_queue(Bench& bench, Renderer* renderer) {
+	if (!bench.selected("command_submit"))
+		return;
+
+	const size_t MESHES = 8;
+	const size_t DRAWS = 4096;
+
+	std::vector<Mesh*> meshes;
+	std::vector<Shader*> shaders;
+
+	for (size_t i = 0; i < MESHES; i++) {
+		Mesh* mesh = new Mesh();
+		mesh->grid(1, 1);
+		meshes.push_back(mesh);
+	}
+
+	const std::string sines = "#define ATTRIBUTELESS\n" + Waves().define();
+
+	shaders.push_back(new Shader("plane.vert", "plane.frag", sines.c_str()));
+	shaders.push_back(new Shader("plane.vert", "plane.frag", "#define ATTRIBUTELESS\n#define OCEAN\n"));
+
+	JobSystem jobs;
+	CommandQueue queue(jobs.size());
+	const size_t per_list = DRAWS / queue.size();
+
+	bench.measure("command_submit", DRAWS, "draws", [&] {
+		jobs.parallel_for(queue.size(), 1, [&](size_t begin, size_t end) {
+			for (size_t l = begin; l < end; l++) {
+				for (size_t i = 0; i < per_list; i++)
+					queue.list(l).draw(0, meshes[(i * 7 + l) % MESHES], shaders[(i * 3 + l) % shaders.size()]);
+			}
+		});
+
+		renderer->clear();
+		renderer->submit(&queue);
+		GL_CALL(glFinish());
+	});
+
+	RenderState& state = renderer->render_state();
+	fprintf(stderr, "%-24s %zu binds, %zu skipped\n", "", state.binds(), state.skips());
+
+	for (Shader* shader : shaders)
+		delete shader;
+
+	for (Mesh* mesh : meshes)
+		delete mesh;
+}
+
+// The water plane made by upload, one iteration is a whole frame
+static void bench_frames(Bench& bench, Renderer* renderer, const char* name, void (*upload)(Mesh*)) {
+	if (!bench.selected(name))
+		return;
+
+	Mesh* plane = new Mesh();
+	upload(plane);
+
+	Waves surface;
+	const std::string defines = "#define QUANTIZED\n" + surface.define();
+
+	Shader* shader = new Shader("plane.vert", "plane.frag", defines.c_str());
+	UniformBuffer<WaveBlock>* waves = new UniformBuffer<WaveBlock>(0, surface.block());
+	shader->uniform_block("Waves", waves->binding());
+
+	Location1F utime = shader->uniform1f("time");
+	utime.set(0.0f);
+
+	Location1F uspacing = shader->uniform1f("spacing");
+	uspacing.set(SPACING);
+
+	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 640.0f / 480.0f, 1.0f, 1000.0f);
+	glm::mat4 view = glm::translate(glm::mat4(1.0f), glm::vec3(0.0f, -1.0f, -5.0f));
+	glm::mat4 rotateDownward = glm::rotate(glm::mat4(1.0f), glm::radians(10.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+	glm::mat4 model = glm::translate(glm::mat4(1.0f), glm::vec3(-1.0f, 0.0f, 0.0f));
+	glm::mat4 mvp = projection * rotateDownward * view * model;
+
+	LocationMat4F umvp = shader->uniformMat4f("mvp");
+	umvp.set(&mvp);
+
+	renderer->culling(true, GL_BACK, GL_CCW);
+
+	bench.measure(name, 1, "frames", [&] {
+		renderer->clear();
+		renderer->render(plane, shader);
+		utime.set(utime.get() + 1.0f / 60.0f);
+		renderer->swap_buffers();
+	});
+
+	delete waves;
+	delete shader;
+	delete plane;
+}
+
+int main(int argc, char** argv) {
+	Bench bench;
+	const char* out = nullptr;
+	const char* image = nullptr;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--filter") && i + 1 < argc)
+			bench.filter = argv[++i];
+		else if (!strcmp(argv[i], "--out") && i + 1 < argc)
+			out = argv[++i];
+		else if (!strcmp(argv[i], "--image") && i + 1 < argc)
+			image = argv[++i];
+		else if (!strcmp(argv[i], "--min-time") && i + 1 < argc)
+			bench.min_time = atof(argv[++i]);
+		else
+			fprintf(stderr, "unknown option: %s\n", argv[i]);
+	}
+
+	bench_plane(bench);
+	bench_sort(bench);
+	bench_jobs(bench);
+
+	Renderer* renderer = new Renderer(640, 480, "bench");
+
+	if (renderer->start_headless()) {
+		bench_upload(bench);
+		bench_shaders(bench);
+
+		const char* path = image ? image : make_image(1024);
+
+		if (path)
+			bench_texture(bench, path);
+
+		if (path && !image)
+			remove(path);
+
+		bench_queue(bench, renderer);
+		bench_frames(bench, renderer, "frames", [](Mesh* mesh) { upload_plane(mesh, nullptr); });
+		bench_frames(bench, renderer, "frames_strips", upload_plane_strips);
+	} else {
+		fprintf(stderr, "no headless context, only CPU benchmarks ran\n");
+	}
+
+	delete renderer;
+
+	FILE* file = out ? fopen(out, "w") : stdout;
+
+	if (!file) {
+		fprintf(stderr, "could not open %s\n", out);
+		return 1;
+	}
+
+	bench.report(file);
+
+	if (out)
+		fclose(file);
+}
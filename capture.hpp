@@ -0,0 +1,372 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "log.hpp"
+
+enum class CaptureFormat {
+	// rgb24 rows top to bottom, for ffmpeg -f rawvideo
+	RAW,
+	// YUV4MPEG2, 4:2:0 full range
+	Y4M,
+	// one binary PPM per frame, numbered where a %d, %Nd or %0Nd in the path
+	// says, or in 6 digits before the extension
+	PPM,
+};
+
+// Reads frames back without waiting on the GPU. Every frame goes into the next
+// pixel buffer of a ring with a fence behind it, and the oldest one is mapped
+// once the ring wraps, so the copy of frame N is only touched while frame
+// N + slots - 1 renders. Converting and writing happen on a thread of their own.
+struct Capture {
+
+	// frames waiting for the writer before frame() blocks
+	static constexpr size_t QUEUE = 8;
+
+	Capture(const char* path, size_t width, size_t height, CaptureFormat format, size_t slots = 3, int fps = 60)
+		: path(path), width(width), height(height), format(format), fps(fps) {
+		assert(slots >= 2 && width > 0 && height > 0);
+
+		const size_t size = width * height * 4;
+
+		ring.resize(slots);
+
+		for (Slot& slot : ring) {
+			GL_CALL(glGenBuffers(1, &slot.buffer));
+			GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer));
+			GL_CALL(glBufferData(GL_PIXEL_PACK_BUFFER, size, nullptr, GL_STREAM_READ));
+		}
+
+		GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+		for (size_t i = 0; i < QUEUE; i++)
+			spare.emplace_back(size);
+
+		if (format == CaptureFormat::PPM) {
+			frame_names();
+		} else {
+			file = fopen(path, "wb");
+
+			if (!file)
+				gl_log_error("ERROR: could not open capture file %s\n", path);
+			else if (format == CaptureFormat::Y4M)
+				fprintf(file, "YUV4MPEG2 W%zu H%zu F%d:1 Ip A1:1 C420jpeg\n", width, height, fps);
+		}
+
+		writer = std::thread([this] { write(); });
+	}
+
+	~Capture() {
+		// the frames still in the ring are waited for
+		for (size_t i = 0; i < ring.size(); i++) {
+			collect(ring[next]);
+			next = (next + 1) % ring.size();
+		}
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			stopping = true;
+		}
+
+		ready.notify_one();
+		writer.join();
+
+		for (Slot& slot : ring) {
+			GL_CALL(glDeleteBuffers(1, &slot.buffer));
+		}
+
+		if (file)
+			fclose(file);
+	}
+
+	// Queues a read of the current read framebuffer, before it is swapped
+	void frame() {
+		Slot& slot = ring[next];
+
+		collect(slot);
+
+		GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer));
+		GL_CALL(glPixelStorei(GL_PACK_ALIGNMENT, 1));
+		GL_CALL(glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
+		GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+		GL_CALL(slot.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+		slot.number = captured++;
+
+		next = (next + 1) % ring.size();
+	}
+
+	// Frames handed to the capture so far
+	size_t frames() {
+		return captured;
+	}
+
+private:
+	struct Slot {
+		GLuint buffer = 0;
+		GLsync fence = nullptr;
+		size_t number = 0;
+	};
+
+	struct Frame {
+		std::vector<uint8_t> pixels;
+		size_t number;
+	};
+
+	// Moves the pixels of a used slot to the writer, waiting for them if needed
+	void collect(Slot& slot) {
+		if (!slot.fence)
+			return;
+
+		GLenum status;
+		GL_CALL(status = glClientWaitSync(slot.fence, GL_SYNC_FLUSH_COMMANDS_BIT, UINT64_MAX));
+		GL_CALL(glDeleteSync(slot.fence));
+		slot.fence = nullptr;
+
+		if (status == GL_WAIT_FAILED) {
+			gl_log_error("ERROR: capture fence failed on frame %zu\n", slot.number);
+			return;
+		}
+
+		std::vector<uint8_t> pixels;
+
+		{
+			std::unique_lock<std::mutex> lock(mutex);
+			room.wait(lock, [this] { return !spare.empty(); });
+			pixels = std::move(spare.back());
+			spare.pop_back();
+		}
+
+		GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, slot.buffer));
+
+		const void* mapped;
+		GL_CALL(mapped = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, pixels.size(), GL_MAP_READ_BIT));
+
+		if (mapped) {
+			memcpy(pixels.data(), mapped, pixels.size());
+			GL_CALL(glUnmapBuffer(GL_PIXEL_PACK_BUFFER));
+		}
+
+		GL_CALL(glBindBuffer(GL_PIXEL_PACK_BUFFER, 0));
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			queue.push_back({std::move(pixels), slot.number});
+		}
+
+		ready.notify_one();
+	}
+
+	void write() {
+		std::vector<uint8_t> converted;
+
+		while (true) {
+			Frame frame;
+
+			{
+				std::unique_lock<std::mutex> lock(mutex);
+				ready.wait(lock, [this] { return stopping || !queue.empty(); });
+
+				if (queue.empty())
+					return;
+
+				frame = std::move(queue.front());
+				queue.pop_front();
+			}
+
+			if (format == CaptureFormat::Y4M)
+				write_y4m(frame.pixels, converted);
+			else if (format == CaptureFormat::PPM)
+				write_ppm(frame.pixels, converted, frame.number);
+			else
+				write_raw(frame.pixels, converted);
+
+			{
+				std::lock_guard<std::mutex> lock(mutex);
+				spare.push_back(std::move(frame.pixels));
+			}
+
+			room.notify_one();
+		}
+	}
+
+	// OpenGL rows go bottom to top, files top to bottom
+	void to_rgb(const std::vector<uint8_t>& rgba, std::vector<uint8_t>& rgb) {
+		rgb.resize(width * height * 3);
+
+		for (size_t y = 0; y < height; y++) {
+			const uint8_t* source = rgba.data() + (height - 1 - y) * width * 4;
+			uint8_t* target = rgb.data() + y * width * 3;
+
+			for (size_t x = 0; x < width; x++) {
+				target[3 * x] = source[4 * x];
+				target[3 * x + 1] = source[4 * x + 1];
+				target[3 * x + 2] = source[4 * x + 2];
+			}
+		}
+	}
+
+	void write_raw(const std::vector<uint8_t>& rgba, std::vector<uint8_t>& rgb) {
+		if (!file)
+			return;
+
+		to_rgb(rgba, rgb);
+		fwrite(rgb.data(), 1, rgb.size(), file);
+	}
+
+	// Splits the path around the frame number, the path is never a format
+	// string: only one integer conversion is taken from it, anything else with
+	// a % is used as a plain name with the number before the extension
+	void frame_names() {
+		const std::string pattern = path;
+		const size_t percent = pattern.find('%');
+
+		if (percent != std::string::npos) {
+			size_t end = percent + 1;
+			char pad = ' ';
+
+			if (end < pattern.size() && pattern[end] == '0') {
+				pad = '0';
+				end++;
+			}
+
+			size_t digits = 0;
+
+			while (end < pattern.size() && pattern[end] >= '0' && pattern[end] <= '9')
+				digits = std::min<size_t>(digits * 10 + (pattern[end++] - '0'), 32);
+
+			if (end < pattern.size() && (pattern[end] == 'd' || pattern[end] == 'i') && pattern.find('%', end) == std::string::npos) {
+				name_prefix = pattern.substr(0, percent);
+				name_suffix = pattern.substr(end + 1);
+				name_digits = digits;
+				name_pad = pad;
+				return;
+			}
+
+			gl_log_error("ERROR: capture path %s needs a single %%d for the frame number, numbering before the extension\n", path);
+		}
+
+		const size_t dot = pattern.rfind('.');
+		const size_t slash = pattern.rfind('/');
+		const size_t split = dot != std::string::npos && (slash == std::string::npos || dot > slash) ? dot : pattern.size();
+
+		name_prefix = pattern.substr(0, split);
+		name_suffix = pattern.substr(split);
+		name_digits = 6;
+		name_pad = '0';
+	}
+
+	void write_ppm(const std::vector<uint8_t>& rgba, std::vector<uint8_t>& rgb, size_t number) {
+		std::string digits = std::to_string(number);
+
+		if (digits.size() < name_digits)
+			digits.insert(0, name_digits - digits.size(), name_pad);
+
+		const std::string name = name_prefix + digits + name_suffix;
+
+		FILE* image = fopen(name.c_str(), "wb");
+
+		if (!image) {
+			gl_log_error("ERROR: could not open capture image %s\n", name.c_str());
+			return;
+		}
+
+		to_rgb(rgba, rgb);
+
+		fprintf(image, "P6\n%zu %zu\n255\n", width, height);
+		fwrite(rgb.data(), 1, rgb.size(), image);
+		fclose(image);
+	}
+
+	// BT.601 full range, chroma averaged over 2x2 blocks
+	void write_y4m(const std::vector<uint8_t>& rgba, std::vector<uint8_t>& yuv) {
+		if (!file)
+			return;
+
+		const size_t chroma_width = (width + 1) / 2;
+		const size_t chroma_height = (height + 1) / 2;
+
+		yuv.resize(width * height + 2 * chroma_width * chroma_height);
+
+		uint8_t* luma = yuv.data();
+		uint8_t* cb = luma + width * height;
+		uint8_t* cr = cb + chroma_width * chroma_height;
+
+		auto pixel = [&](size_t x, size_t y) {
+			return rgba.data() + ((height - 1 - y) * width + x) * 4;
+		};
+
+		for (size_t y = 0; y < height; y++) {
+			for (size_t x = 0; x < width; x++) {
+				const uint8_t* p = pixel(x, y);
+				luma[y * width + x] = (uint8_t)std::min(255.0f, 0.299f * p[0] + 0.587f * p[1] + 0.114f * p[2] + 0.5f);
+			}
+		}
+
+		for (size_t y = 0; y < chroma_height; y++) {
+			for (size_t x = 0; x < chroma_width; x++) {
+				float r = 0.0f, g = 0.0f, b = 0.0f;
+				int count = 0;
+
+				for (size_t dy = 0; dy < 2 && 2 * y + dy < height; dy++) {
+					for (size_t dx = 0; dx < 2 && 2 * x + dx < width; dx++) {
+						const uint8_t* p = pixel(2 * x + dx, 2 * y + dy);
+						r += p[0];
+						g += p[1];
+						b += p[2];
+						count++;
+					}
+				}
+
+				r /= count;
+				g /= count;
+				b /= count;
+
+				cb[y * chroma_width + x] = (uint8_t)std::clamp(128.0f - 0.168736f * r - 0.331264f * g + 0.5f * b + 0.5f, 0.0f, 255.0f);
+				cr[y * chroma_width + x] = (uint8_t)std::clamp(128.0f + 0.5f * r - 0.418688f * g - 0.081312f * b + 0.5f, 0.0f, 255.0f);
+			}
+		}
+
+		fputs("FRAME\n", file);
+		fwrite(yuv.data(), 1, yuv.size(), file);
+	}
+
+	const char* path;
+	size_t width, height;
+	CaptureFormat format;
+	int fps;
+
+	FILE* file = nullptr;
+
+	// PPM file names, prefix, number padded to digits, suffix
+	std::string name_prefix, name_suffix;
+	size_t name_digits = 0;
+	char name_pad = '0';
+
+	std::vector<Slot> ring;
+	size_t next = 0;
+	size_t captured = 0;
+
+	// buffers go from spare to queue when read back, and return once written
+	std::mutex mutex;
+	std::condition_variable ready;
+	std::condition_variable room;
+	std::vector<std::vector<uint8_t>> spare;
+	std::deque<Frame> queue;
+	bool stopping = false;
+
+	std::thread writer;
+};
@@ -0,0 +1,137 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "log.hpp"
+#include "mesh.hpp"
+#include "shader.hpp"
+#include "renderer.hpp"
+
+#include "vendor/glm/glm.hpp"
+
+struct ClipmapConfig {
+	// nested square rings, the spacing doubles on each one
+	int levels = 10;
+	// cells per side of every level, multiple of 4 and at least 8
+	int size = 128;
+	// cell size of the finest level, in plane units
+	float spacing = 0.01f;
+};
+
+// Geometry clipmap around the camera, drawn with the attributeless grid path.
+//
+// Level L is a size x size grid of cells of spacing * 2^L whose corner sits on
+// an even cell, so its vertices are also vertices of level L + 1. Level 0 is a
+// full square, every other level is the ring left around the previous one,
+// drawn as four rectangles. The hole can only be off center by one cell, which
+// is what keeps levels snapped as the camera moves instead of swimming.
+//
+// The shader (plane.vert with ATTRIBUTELESS and CLIPMAP) needs the origin of the
+// rectangle and the bounds of its level, in cells of that level, to stitch the
+// odd vertices of the outer edge to the coarser level.
+struct Clipmap {
+
+	Clipmap(const ClipmapConfig& config, Shader* shader)
+		: config(config),
+		  uorigin(shader->uniform2i("origin")),
+		  ubounds(shader->uniform4i("bounds")),
+		  uspacing(shader->uniform1f("spacing")) {
+		assert(config.levels > 0 && config.size >= 8 && config.size % 4 == 0);
+
+		mesh = new Mesh();
+	}
+
+	~Clipmap() {
+		delete mesh;
+	}
+
+	// Rebuilds the rectangles around the camera, given in plane coordinates
+	void update(glm::vec2 camera) {
+		patches.clear();
+
+		const int size = config.size;
+
+		glm::ivec2 corner = glm::ivec2(0);
+		glm::ivec2 hole = glm::ivec2(0);
+
+		for (int level = 0; level < config.levels; level++) {
+			const float spacing = config.spacing * std::ldexp(1.0f, level);
+
+			if (level == 0) {
+				glm::vec2 center = camera / spacing - glm::vec2(size / 2);
+				corner = 2 * glm::ivec2(glm::floor(center * 0.5f));
+
+				patches.push_back({corner, glm::ivec2(size), corner, level});
+				continue;
+			}
+
+			// the previous level, in cells of this one
+			hole = corner / 2;
+			corner = 2 * floor_div(hole - size / 4, 2);
+
+			const int half = size / 2;
+			const glm::ivec2 end = corner + size;
+			const glm::ivec2 hole_end = hole + half;
+
+			patches.push_back({corner, {size, hole.y - corner.y}, corner, level});
+			patches.push_back({{corner.x, hole_end.y}, {size, end.y - hole_end.y}, corner, level});
+			patches.push_back({{corner.x, hole.y}, {hole.x - corner.x, half}, corner, level});
+			patches.push_back({{hole_end.x, hole.y}, {end.x - hole_end.x, half}, corner, level});
+		}
+	}
+
+	void render(Renderer* renderer, Shader* shader) {
+		for (const Patch& patch : patches) {
+			const glm::ivec2 end = patch.corner + config.size;
+
+			uorigin.set(patch.origin);
+			ubounds.set(glm::ivec4(patch.corner, end));
+			uspacing.set(config.spacing * std::ldexp(1.0f, patch.level));
+
+			// instances walk x and vertices walk z
+			mesh->grid(patch.cells.y, patch.cells.x);
+			renderer->render(mesh, shader);
+		}
+	}
+
+	size_t vertex_count() {
+		size_t count = 0;
+
+		for (const Patch& patch : patches)
+			count += (size_t)(patch.cells.x + 1) * (patch.cells.y + 1);
+
+		return count;
+	}
+
+	// Side of the covered square, in plane units
+	float extent() {
+		return config.size * config.spacing * std::ldexp(1.0f, config.levels - 1);
+	}
+
+private:
+	struct Patch {
+		glm::ivec2 origin;
+		glm::ivec2 cells;
+		// lower corner of the level the patch belongs to
+		glm::ivec2 corner;
+		int level;
+	};
+
+	static glm::ivec2 floor_div(glm::ivec2 value, int divisor) {
+		return glm::ivec2(glm::floor(glm::vec2(value) / (float)divisor));
+	}
+
+	ClipmapConfig config;
+	std::vector<Patch> patches;
+
+	Mesh* mesh;
+
+	Location2I uorigin;
+	Location4I ubounds;
+	Location1F uspacing;
+};
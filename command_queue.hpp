@@ -0,0 +1,244 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <initializer_list>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "log.hpp"
+#include "mesh.hpp"
+#include "shader.hpp"
+
+// What the GL thread last bound, so binding the same thing again costs nothing.
+// Anything that binds programs, vertex arrays or textures behind its back has to
+// call invalidate(), the renderer does at the start of every frame.
+struct RenderState {
+
+	// texture units tracked, higher ones are bound every time
+	static constexpr size_t SLOTS = 8;
+
+	RenderState() {
+		invalidate();
+	}
+
+	void use(Shader* shader) {
+		if (shader->id() == program) {
+			skip_count++;
+			return;
+		}
+
+		shader->bind();
+		program = shader->id();
+		bind_count++;
+	}
+
+	void bind(Mesh* mesh) {
+		if (mesh->id() == vertex_array) {
+			skip_count++;
+			return;
+		}
+
+		mesh->bind();
+		vertex_array = mesh->id();
+		bind_count++;
+	}
+
+	void texture(unsigned int slot, GLuint texture) {
+		if (slot < SLOTS && textures[slot] == texture) {
+			skip_count++;
+			return;
+		}
+
+		if (slot != active) {
+			GL_CALL(glActiveTexture(GL_TEXTURE0 + slot));
+			active = slot;
+		}
+
+		GL_CALL(glBindTexture(GL_TEXTURE_2D, texture));
+
+		if (slot < SLOTS)
+			textures[slot] = texture;
+
+		bind_count++;
+	}
+
+	// Forgets everything, the next binds all go through
+	void invalidate() {
+		program = UNKNOWN;
+		vertex_array = UNKNOWN;
+		active = UNKNOWN;
+
+		for (GLuint& texture : textures)
+			texture = UNKNOWN;
+	}
+
+	// State changes made and the ones skipped as redundant, since the start
+	size_t binds() {
+		return bind_count;
+	}
+
+	size_t skips() {
+		return skip_count;
+	}
+
+private:
+	static constexpr GLuint UNKNOWN = ~0u;
+
+	GLuint program;
+	GLuint vertex_array;
+	GLuint active;
+	GLuint textures[SLOTS];
+
+	size_t bind_count = 0;
+	size_t skip_count = 0;
+};
+
+// One draw, self contained so it can be made on any thread. The textures go on
+// units 0 and up, a zero leaves what is on the unit alone.
+struct DrawCommand {
+	uint64_t key;
+	Mesh* mesh;
+	Shader* shader;
+	GLuint textures[RenderState::SLOTS];
+};
+
+// Draws recorded by one thread, in any order
+struct CommandList {
+
+	// Passes are drawn in order, within one the draws are grouped by program,
+	// then vertex array, then first texture
+	static uint64_t key(uint8_t pass, GLuint program, GLuint vertex_array, GLuint texture) {
+		return (uint64_t)pass << 56 | (uint64_t)(program & 0xffff) << 40 | (uint64_t)(vertex_array & 0xfffff) << 20 | (texture & 0xfffff);
+	}
+
+	void draw(uint8_t pass, Mesh* mesh, Shader* shader, std::initializer_list<GLuint> textures = {}) {
+		assert(mesh && shader && textures.size() <= RenderState::SLOTS);
+
+		DrawCommand command = {0, mesh, shader, {}};
+		size_t slot = 0;
+
+		for (GLuint texture : textures)
+			command.textures[slot++] = texture;
+
+		command.key = key(pass, shader->id(), mesh->id(), command.textures[0]);
+		commands.push_back(command);
+	}
+
+	size_t size() {
+		return commands.size();
+	}
+
+	std::vector<DrawCommand> commands;
+};
+
+// Draws recorded into several lists, each filled by one thread at a time,
+// then sorted by key and issued on the GL thread through a RenderState. The
+// sort is stable, draws with the same key keep the order they were recorded
+// in, list by list.
+struct CommandQueue {
+
+	CommandQueue(size_t lists = 1) {
+		resize(lists);
+	}
+
+	// Only while nothing is recording
+	void resize(size_t lists) {
+		assert(lists > 0);
+		this->lists.resize(lists);
+	}
+
+	size_t size() {
+		return lists.size();
+	}
+
+	CommandList& list(size_t index = 0) {
+		assert(index < lists.size());
+		return lists[index];
+	}
+
+	// Issues everything recorded so far and empties the lists
+	void submit(RenderState& state) {
+		order.clear();
+
+		for (size_t l = 0; l < lists.size(); l++) {
+			for (size_t c = 0; c < lists[l].commands.size(); c++)
+				order.push_back({lists[l].commands[c].key, (uint32_t)l, (uint32_t)c});
+		}
+
+		sort(order, scratch);
+
+		for (const Entry& entry : order) {
+			const DrawCommand& command = lists[entry.list].commands[entry.command];
+
+			state.use(command.shader);
+			state.bind(command.mesh);
+
+			for (unsigned int slot = 0; slot < RenderState::SLOTS; slot++) {
+				if (command.textures[slot])
+					state.texture(slot, command.textures[slot]);
+			}
+
+			command.mesh->draw();
+		}
+
+		draw_count += order.size();
+
+		for (CommandList& list : lists)
+			list.commands.clear();
+	}
+
+	// Draws submitted so far
+	size_t draws() {
+		return draw_count;
+	}
+
+	struct Entry {
+		uint64_t key;
+		uint32_t list;
+		uint32_t command;
+	};
+
+	// Least significant digit radix sort on the keys, a byte per pass. Passes
+	// where every key has the same byte move nothing and are skipped, which is
+	// most of them with a handful of programs and meshes.
+	static void sort(std::vector<Entry>& entries, std::vector<Entry>& scratch) {
+		if (entries.size() < 2)
+			return;
+
+		scratch.resize(entries.size());
+
+		for (int shift = 0; shift < 64; shift += 8) {
+			size_t counts[256] = {};
+
+			for (const Entry& entry : entries)
+				counts[(entry.key >> shift) & 0xff]++;
+
+			if (counts[(entries[0].key >> shift) & 0xff] == entries.size())
+				continue;
+
+			size_t sum = 0;
+
+			for (size_t& count : counts) {
+				size_t bucket = count;
+				count = sum;
+				sum += bucket;
+			}
+
+			for (const Entry& entry : entries)
+				scratch[counts[(entry.key >> shift) & 0xff]++] = entry;
+
+			entries.swap(scratch);
+		}
+	}
+
+private:
+	std::vector<CommandList> lists;
+
+	std::vector<Entry> order;
+	std::vector<Entry> scratch;
+
+	size_t draw_count = 0;
+};
@@ -0,0 +1,194 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "simd.hpp"
+#include "job_system.hpp"
+
+// Square 2D complex FFT of power of two size, on separate real and imaginary
+// row major arrays.
+//
+// Every pass transforms columns, which lets the radix-2 butterflies run on
+// whole runs of adjacent columns at once: element c of two rows is the same
+// operation for every c, so the kernels are plain vertical SIMD with no
+// shuffles. Rows are done by transposing and running the column pass again.
+// The column runs are split over the job system.
+struct FFT2D {
+
+	// columns handed to a task, a multiple of the widest kernel
+	static constexpr size_t BLOCK = 16;
+
+	FFT2D(size_t n, JobSystem* jobs, SimdLevel level = simd_detect()) : n(n), jobs(jobs), simd(level) {
+		assert(n >= BLOCK && (n & (n - 1)) == 0);
+
+		size_t bits = 0;
+		while ((size_t(1) << bits) < n)
+			bits++;
+
+		reversed.resize(n);
+
+		for (size_t i = 0; i < n; i++) {
+			size_t r = 0;
+
+			for (size_t b = 0; b < bits; b++)
+				r |= ((i >> b) & 1) << (bits - 1 - b);
+
+			reversed[i] = r;
+		}
+
+		// e^(2 pi i k / n) for the inverse transform
+		twiddle_re.resize(n / 2);
+		twiddle_im.resize(n / 2);
+
+		for (size_t k = 0; k < n / 2; k++) {
+			double angle = 2.0 * M_PI * k / n;
+			twiddle_re[k] = std::cos(angle);
+			twiddle_im[k] = std::sin(angle);
+		}
+	}
+
+	// Unnormalized inverse transform, in place
+	void inverse(float* re, float* im) {
+		columns(re, im);
+		transpose(re);
+		transpose(im);
+		columns(re, im);
+		transpose(re);
+		transpose(im);
+	}
+
+	size_t size() {
+		return n;
+	}
+
+private:
+	void columns(float* re, float* im) {
+		jobs->parallel_for(n / BLOCK, 1, [&](size_t begin, size_t end) {
+			for (size_t block = begin; block < end; block++)
+				columns(re, im, block * BLOCK);
+		});
+	}
+
+	void columns(float* re, float* im, size_t column) {
+		for (size_t i = 0; i < n; i++) {
+			size_t j = reversed[i];
+
+			if (j <= i)
+				continue;
+
+			for (size_t c = column; c < column + BLOCK; c++) {
+				std::swap(re[i * n + c], re[j * n + c]);
+				std::swap(im[i * n + c], im[j * n + c]);
+			}
+		}
+
+		for (size_t half = 1; half < n; half *= 2) {
+			const size_t stride = n / (2 * half);
+
+			for (size_t start = 0; start < n; start += 2 * half) {
+				for (size_t k = 0; k < half; k++) {
+					const size_t a = (start + k) * n + column;
+					const size_t b = a + half * n;
+
+					butterflies(twiddle_re[k * stride], twiddle_im[k * stride], re + a, im + a, re + b, im + b);
+				}
+			}
+		}
+	}
+
+	void butterflies(float wr, float wi, float* ar, float* ai, float* br, float* bi) {
+#if SIMD_X86
+		if (simd == SimdLevel::AVX2) {
+			butterflies_avx2(wr, wi, ar, ai, br, bi);
+			return;
+		}
+
+		if (simd == SimdLevel::SSE) {
+			butterflies_sse(wr, wi, ar, ai, br, bi);
+			return;
+		}
+#endif
+		for (size_t c = 0; c < BLOCK; c++) {
+			float tr = wr * br[c] - wi * bi[c];
+			float ti = wr * bi[c] + wi * br[c];
+
+			br[c] = ar[c] - tr;
+			bi[c] = ai[c] - ti;
+			ar[c] += tr;
+			ai[c] += ti;
+		}
+	}
+
+#if SIMD_X86
+	SIMD_TARGET_SSE static void butterflies_sse(float wr, float wi, float* ar, float* ai, float* br, float* bi) {
+		const __m128 vr = _mm_set1_ps(wr);
+		const __m128 vi = _mm_set1_ps(wi);
+
+		for (size_t c = 0; c < BLOCK; c += 4) {
+			__m128 xr = _mm_loadu_ps(br + c);
+			__m128 xi = _mm_loadu_ps(bi + c);
+
+			__m128 tr = _mm_sub_ps(_mm_mul_ps(vr, xr), _mm_mul_ps(vi, xi));
+			__m128 ti = _mm_add_ps(_mm_mul_ps(vr, xi), _mm_mul_ps(vi, xr));
+
+			__m128 yr = _mm_loadu_ps(ar + c);
+			__m128 yi = _mm_loadu_ps(ai + c);
+
+			_mm_storeu_ps(br + c, _mm_sub_ps(yr, tr));
+			_mm_storeu_ps(bi + c, _mm_sub_ps(yi, ti));
+			_mm_storeu_ps(ar + c, _mm_add_ps(yr, tr));
+			_mm_storeu_ps(ai + c, _mm_add_ps(yi, ti));
+		}
+	}
+
+	SIMD_TARGET_AVX2 static void butterflies_avx2(float wr, float wi, float* ar, float* ai, float* br, float* bi) {
+		const __m256 vr = _mm256_set1_ps(wr);
+		const __m256 vi = _mm256_set1_ps(wi);
+
+		for (size_t c = 0; c < BLOCK; c += 8) {
+			__m256 xr = _mm256_loadu_ps(br + c);
+			__m256 xi = _mm256_loadu_ps(bi + c);
+
+			__m256 tr = _mm256_fmsub_ps(vr, xr, _mm256_mul_ps(vi, xi));
+			__m256 ti = _mm256_fmadd_ps(vr, xi, _mm256_mul_ps(vi, xr));
+
+			__m256 yr = _mm256_loadu_ps(ar + c);
+			__m256 yi = _mm256_loadu_ps(ai + c);
+
+			_mm256_storeu_ps(br + c, _mm256_sub_ps(yr, tr));
+			_mm256_storeu_ps(bi + c, _mm256_sub_ps(yi, ti));
+			_mm256_storeu_ps(ar + c, _mm256_add_ps(yr, tr));
+			_mm256_storeu_ps(ai + c, _mm256_add_ps(yi, ti));
+		}
+	}
+#endif
+
+	// In place, BLOCK x BLOCK tiles swapped with their mirror
+	void transpose(float* data) {
+		const size_t blocks = n / BLOCK;
+
+		jobs->parallel_for(blocks, 1, [&](size_t begin, size_t end) {
+			for (size_t bi = begin; bi < end; bi++) {
+				for (size_t bj = bi; bj < blocks; bj++) {
+					for (size_t i = bi * BLOCK; i < (bi + 1) * BLOCK; i++) {
+						size_t first = bi == bj ? i + 1 : bj * BLOCK;
+
+						for (size_t j = first; j < (bj + 1) * BLOCK; j++)
+							std::swap(data[i * n + j], data[j * n + i]);
+					}
+				}
+			}
+		});
+	}
+
+	size_t n;
+	JobSystem* jobs;
+	SimdLevel simd;
+
+	std::vector<size_t> reversed;
+	std::vector<float> twiddle_re;
+	std::vector<float> twiddle_im;
+};
@@ -0,0 +1,120 @@
+#pragma once
+
+#include <atomic>
+#include <map>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+#include "log.hpp"
+
+// Tells which files changed, from inotify on a thread of its own so nothing on
+// the frame waits for the file system. Directories are watched rather than the
+// files, editors often save by writing a new file and renaming it over the old
+// one, which a watch on the file itself would lose.
+struct FileWatch {
+
+	FileWatch() {
+		descriptor = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+
+		if (descriptor < 0) {
+			gl_log_error("ERROR: inotify unavailable, files are not watched\n");
+			return;
+		}
+
+		watcher = std::thread([this] { watch(); });
+	}
+
+	~FileWatch() {
+		stopping = true;
+
+		if (watcher.joinable())
+			watcher.join();
+
+		if (descriptor >= 0)
+			close(descriptor);
+	}
+
+	// Watches path from now on, relative paths go by the working directory
+	void add(const std::string& path) {
+		if (descriptor < 0)
+			return;
+
+		size_t slash = path.rfind('/');
+		std::string directory = slash == std::string::npos ? "." : path.substr(0, slash);
+		std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+
+		std::lock_guard<std::mutex> lock(mutex);
+
+		int watch = inotify_add_watch(descriptor, directory.c_str(), IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+
+		if (watch < 0) {
+			gl_log_error("ERROR: could not watch %s\n", directory.c_str());
+			return;
+		}
+
+		// adding a directory twice gives back the same watch
+		directories[watch] = directory;
+		files.insert(directory + "/" + name);
+	}
+
+	// Watched files changed since the last call, each once however many times it was written
+	std::vector<std::string> changes() {
+		std::lock_guard<std::mutex> lock(mutex);
+
+		std::vector<std::string> result(changed.begin(), changed.end());
+		changed.clear();
+
+		return result;
+	}
+
+private:
+	void watch() {
+		alignas(inotify_event) char buffer[4096];
+
+		while (!stopping) {
+			pollfd request = {descriptor, POLLIN, 0};
+
+			// wakes up now and then to notice stopping
+			if (poll(&request, 1, 100) <= 0)
+				continue;
+
+			ssize_t length = read(descriptor, buffer, sizeof(buffer));
+
+			if (length <= 0)
+				continue;
+
+			std::lock_guard<std::mutex> lock(mutex);
+
+			for (char* next = buffer; next < buffer + length; ) {
+				const inotify_event* event = (const inotify_event*)next;
+				next += sizeof(inotify_event) + event->len;
+
+				auto directory = directories.find(event->wd);
+
+				if (directory == directories.end() || !event->len)
+					continue;
+
+				std::string path = directory->second + "/" + event->name;
+
+				if (files.count(path))
+					changed.insert(path);
+			}
+		}
+	}
+
+	int descriptor = -1;
+	std::thread watcher;
+	std::atomic<bool> stopping{false};
+
+	std::mutex mutex;
+	std::map<int, std::string> directories;
+	std::set<std::string> files;
+	std::set<std::string> changed;
+};
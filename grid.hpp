@@ -0,0 +1,158 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <chrono>
+#include <cstdint>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "log.hpp"
+#include "mesh.hpp"
+#include "job_system.hpp"
+
+// A square grid of cells x cells, made on the job system straight into the
+// mesh's mapped buffers, nothing stays behind in host memory. Vertices are
+// whole cells, a uvec2 of unsigned shorts, the shader scales them. Triangles
+// are a list, two a cell, front facing from above with GL_CCW.
+//
+// The grid is cut into columns of BLOCK_CELLS cells, walked a row at a time,
+// so a row of vertices is still in a 16 entry cache when the next row uses it
+// again. Vertices are numbered column by column in the same way, each row of
+// a column is contiguous. Every column is written by one task, from closed
+// form offsets, so they need no coordination.
+struct GridBuilder {
+
+	// Cells across a column, two rows of its vertices fit in the vertex cache
+	static constexpr int BLOCK_CELLS = 6;
+
+	GridBuilder(int cells, JobSystem* jobs = nullptr) : cells(cells), jobs(jobs) {
+		assert(cells > 0 && cells <= 0xffff && "Grid cells have to fit unsigned shorts");
+	}
+
+	size_t vertex_count() {
+		return (size_t)(cells + 1) * (cells + 1);
+	}
+
+	size_t index_count() {
+		return (size_t)6 * cells * cells;
+	}
+
+	// Index of the vertex at row x, column z
+	size_t vertex(int x, int z) {
+		const int first = z / BLOCK_CELLS * BLOCK_CELLS;
+		const int width = std::min(BLOCK_CELLS, cells + 1 - first);
+
+		return (size_t)first * (cells + 1) + (size_t)x * width + (z - first);
+	}
+
+	// Column block's vertices, 2 shorts each, and triangles, safe to call from any thread on different blocks
+	void write_block(int block, uint16_t* vertices, unsigned int* indices) {
+		const int first = block * BLOCK_CELLS;
+
+		// there is one column more of vertices than of cells
+		if (first <= cells) {
+			const int width = std::min(BLOCK_CELLS, cells + 1 - first);
+			uint16_t* out = vertices + 2 * vertex(0, first);
+
+			for (int x = 0; x < cells + 1; x++) {
+				for (int z = first; z < first + width; z++) {
+					*out++ = x;
+					*out++ = z;
+				}
+			}
+		}
+
+		if (first < cells) {
+			const int last = std::min(cells, first + BLOCK_CELLS);
+			unsigned int* out = indices + (size_t)6 * first * cells;
+
+			for (int x = 0; x < cells; x++) {
+				for (int z = first; z < last; z++) {
+					const unsigned int zero = vertex(x, z);
+					const unsigned int one = vertex(x, z + 1);
+					const unsigned int two = vertex(x + 1, z);
+					const unsigned int three = vertex(x + 1, z + 1);
+
+					*out++ = zero;
+					*out++ = one;
+					*out++ = three;
+
+					*out++ = zero;
+					*out++ = three;
+					*out++ = two;
+				}
+			}
+		}
+	}
+
+	// The whole grid into memory of vertex_count() * 2 shorts and index_count() indices
+	void write(uint16_t* vertices, unsigned int* indices) {
+		const size_t blocks = cells / BLOCK_CELLS + 1;
+
+		auto job = [&](size_t begin, size_t end) {
+			for (size_t block = begin; block < end; block++)
+				write_block(block, vertices, indices);
+		};
+
+		if (jobs)
+			jobs->parallel_for(blocks, 1, job);
+		else
+			job(0, blocks);
+	}
+
+	// Fills mesh with the grid, for plane.vert with QUANTIZED, false when the
+	// buffers could not be mapped and written
+	bool build(Mesh* mesh) {
+		auto start = std::chrono::steady_clock::now();
+
+		// the driver may lose a mapping, the contents are undefined then and written again
+		bool written = false;
+
+		for (int attempt = 0; attempt < MAP_ATTEMPTS && !written; attempt++) {
+			uint16_t* vertices = (uint16_t*)mesh->map_data(vertex_count() * 2 * sizeof(uint16_t), GL_STATIC_DRAW);
+			unsigned int* indices = mesh->map_indices(index_count() * sizeof(unsigned int), GL_STATIC_DRAW);
+
+			if (vertices && indices)
+				write(vertices, indices);
+
+			const bool vertices_kept = mesh->unmap_data();
+			const bool indices_kept = mesh->unmap_indices();
+
+			written = vertices && indices && vertices_kept && indices_kept;
+
+			if (!written)
+				gl_log_error("ERROR: grid buffers were lost while mapped, attempt %d of %d\n", attempt + 1, MAP_ATTEMPTS);
+		}
+
+		if (!written) {
+			gl_log_error("ERROR: could not write the grid of %d cells into its buffers\n", cells);
+			return false;
+		}
+
+		// a mesh built before already has the layout
+		mesh->clear_attributes();
+		mesh->integer_attributes<uint16_t>(2, 2 * sizeof(uint16_t));
+		mesh->mode(GL_TRIANGLES);
+
+		elapsed = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+		gl_log("grid of %d cells: %zu vertices, %zu indices in %.2f ms on %zu threads\n", cells, vertex_count(), index_count(), elapsed, jobs ? jobs->size() : 1);
+
+		return true;
+	}
+
+	// How long the last build() took, mapping included
+	double milliseconds() {
+		return elapsed;
+	}
+
+private:
+	// times build() maps the buffers before giving up
+	static constexpr int MAP_ATTEMPTS = 3;
+
+	int cells;
+	JobSystem* jobs;
+	double elapsed = 0.0;
+};
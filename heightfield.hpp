@@ -0,0 +1,267 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <vector>
+
+#include "simd.hpp"
+#include "job_system.hpp"
+
+#include "vendor/glm/glm.hpp"
+
+struct HeightfieldConfig {
+	// cells per side
+	int size = 256;
+	// side of the simulated square and its corner, in plane units
+	float length = 10.0f;
+	glm::vec2 origin = glm::vec2(0.0f);
+	// speed of the waves in plane units per second
+	float speed = 0.5f;
+	// seconds for a wave left alone to lose half its height
+	float half_life = 2.0f;
+};
+
+// Damped wave equation on a square grid, for the local water the analytic
+// surfaces can't do: wakes, splashes, things dropped in. The border is held
+// flat, which reflects the waves back in.
+//
+// Every step is an explicit leapfrog: the next height only needs the current
+// heights around it and the previous height of the same cell, so it is written
+// over the previous one and the two buffers swap roles. The grid is cut in
+// tiles that fit in cache, spread over the job system, and each row of a tile
+// goes through a SIMD stencil.
+struct Heightfield {
+
+	// rows and columns of a tile, columns a multiple of the widest kernel
+	static constexpr size_t TILE_ROWS = 32;
+	static constexpr size_t TILE_COLUMNS = 256;
+
+	// a frame that took too long is dropped rather than simulated
+	static constexpr int MAX_STEPS = 8;
+
+	Heightfield(const HeightfieldConfig& config, JobSystem* jobs, SimdLevel level = simd_detect())
+		: config(config), jobs(jobs), simd(level) {
+		assert(config.size >= 3 && config.length > 0.0f && config.speed > 0.0f);
+
+		const size_t n = config.size;
+
+		current.assign(n * n, 0.0f);
+		previous.assign(n * n, 0.0f);
+
+		// a Courant number of one half keeps the 2D scheme stable
+		spacing = config.length / config.size;
+		step_time = 0.5f * spacing / config.speed;
+		coupling = 0.25f;
+		damping = std::pow(0.5f, step_time / config.half_life);
+
+		rows = (n - 2 + TILE_ROWS - 1) / TILE_ROWS;
+		columns = (n - 2 + TILE_COLUMNS - 1) / TILE_COLUMNS;
+		tile_bounds.resize(rows * columns);
+	}
+
+	// Advances the simulation by elapsed seconds, in fixed steps
+	void update(float elapsed) {
+		pending += elapsed;
+
+		int steps = 0;
+
+		while (pending >= step_time && steps < MAX_STEPS) {
+			step();
+			pending -= step_time;
+			steps++;
+		}
+
+		if (steps == MAX_STEPS)
+			pending = 0.0f;
+	}
+
+	// Pushes the water down around position by depth, smoothly to zero at radius
+	void disturb(glm::vec2 position, float radius, float depth) {
+		const int n = config.size;
+		const glm::vec2 center = (position - config.origin) / spacing;
+		const float cells = radius / spacing;
+
+		const int x0 = std::max(1, (int)std::floor(center.x - cells));
+		const int x1 = std::min(n - 2, (int)std::ceil(center.x + cells));
+		const int z0 = std::max(1, (int)std::floor(center.y - cells));
+		const int z1 = std::min(n - 2, (int)std::ceil(center.y + cells));
+
+		for (int z = z0; z <= z1; z++) {
+			for (int x = x0; x <= x1; x++) {
+				const float distance = glm::length(glm::vec2(x, z) - center) / cells;
+
+				if (distance >= 1.0f)
+					continue;
+
+				// on both time levels, so the water starts from rest
+				const float offset = depth * 0.5f * (1.0f + std::cos((float)M_PI * distance));
+				current[(size_t)z * n + x] -= offset;
+				previous[(size_t)z * n + x] -= offset;
+			}
+		}
+
+		height_bound += depth;
+	}
+
+	// Heights, row major with z along the rows
+	const float* heights() {
+		return current.data();
+	}
+
+	// Largest height in the grid, as of the last step plus later disturbances
+	float bound() {
+		return height_bound;
+	}
+
+	int size() {
+		return config.size;
+	}
+
+	float length() {
+		return config.length;
+	}
+
+	glm::vec2 origin() {
+		return config.origin;
+	}
+
+	// Simulated seconds per step
+	float step_seconds() {
+		return step_time;
+	}
+
+	void step() {
+		jobs->parallel_for(rows * columns, 1, [&](size_t begin, size_t end) {
+			for (size_t tile = begin; tile < end; tile++)
+				tile_bounds[tile] = step_tile(tile / columns, tile % columns);
+		});
+
+		std::swap(current, previous);
+
+		height_bound = *std::max_element(tile_bounds.begin(), tile_bounds.end());
+	}
+
+private:
+	float step_tile(size_t tile_row, size_t tile_column) {
+		const size_t n = config.size;
+
+		const size_t z0 = 1 + tile_row * TILE_ROWS;
+		const size_t z1 = std::min(z0 + TILE_ROWS, n - 1);
+		const size_t x0 = 1 + tile_column * TILE_COLUMNS;
+		const size_t x1 = std::min(x0 + TILE_COLUMNS, n - 1);
+
+		float bound = 0.0f;
+
+		for (size_t z = z0; z < z1; z++) {
+			const float* cur = current.data() + z * n;
+			float* next = previous.data() + z * n;
+
+			size_t x = x0;
+
+#if SIMD_X86
+			if (simd == SimdLevel::AVX2)
+				x = row_avx2(next, cur, n, x0, x1, &bound);
+			else if (simd == SimdLevel::SSE)
+				x = row_sse(next, cur, n, x0, x1, &bound);
+#endif
+
+			row_scalar(next, cur, n, x, x1, &bound);
+		}
+
+		return bound;
+	}
+
+	// next = cur + damping (cur - prev) + coupling laplacian(cur), prev lives in next
+	void row_scalar(float* next, const float* cur, size_t n, size_t begin, size_t end, float* bound) {
+		for (size_t x = begin; x < end; x++) {
+			const float laplacian = cur[x - 1] + cur[x + 1] + cur[x - n] + cur[x + n] - 4.0f * cur[x];
+			const float height = cur[x] + damping * (cur[x] - next[x]) + coupling * laplacian;
+
+			next[x] = height;
+			*bound = std::max(*bound, std::fabs(height));
+		}
+	}
+
+#if SIMD_X86
+	SIMD_TARGET_SSE size_t row_sse(float* next, const float* cur, size_t n, size_t begin, size_t end, float* bound) {
+		const __m128 vdamping = _mm_set1_ps(damping);
+		const __m128 vcoupling = _mm_set1_ps(coupling);
+		const __m128 four = _mm_set1_ps(4.0f);
+		const __m128 sign = _mm_set1_ps(-0.0f);
+
+		__m128 vbound = _mm_set1_ps(*bound);
+		size_t x = begin;
+
+		for (; x + 4 <= end; x += 4) {
+			__m128 center = _mm_loadu_ps(cur + x);
+
+			__m128 laplacian = _mm_add_ps(_mm_loadu_ps(cur + x - 1), _mm_loadu_ps(cur + x + 1));
+			laplacian = _mm_add_ps(laplacian, _mm_add_ps(_mm_loadu_ps(cur + x - n), _mm_loadu_ps(cur + x + n)));
+			laplacian = _mm_sub_ps(laplacian, _mm_mul_ps(four, center));
+
+			__m128 velocity = _mm_sub_ps(center, _mm_loadu_ps(next + x));
+			__m128 height = _mm_add_ps(center, _mm_add_ps(_mm_mul_ps(vdamping, velocity), _mm_mul_ps(vcoupling, laplacian)));
+
+			_mm_storeu_ps(next + x, height);
+			vbound = _mm_max_ps(vbound, _mm_andnot_ps(sign, height));
+		}
+
+		float lanes[4];
+		_mm_storeu_ps(lanes, vbound);
+		*bound = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+
+		return x;
+	}
+
+	SIMD_TARGET_AVX2 size_t row_avx2(float* next, const float* cur, size_t n, size_t begin, size_t end, float* bound) {
+		const __m256 vdamping = _mm256_set1_ps(damping);
+		const __m256 vcoupling = _mm256_set1_ps(coupling);
+		const __m256 four = _mm256_set1_ps(4.0f);
+		const __m256 sign = _mm256_set1_ps(-0.0f);
+
+		__m256 vbound = _mm256_set1_ps(*bound);
+		size_t x = begin;
+
+		for (; x + 8 <= end; x += 8) {
+			__m256 center = _mm256_loadu_ps(cur + x);
+
+			__m256 laplacian = _mm256_add_ps(_mm256_loadu_ps(cur + x - 1), _mm256_loadu_ps(cur + x + 1));
+			laplacian = _mm256_add_ps(laplacian, _mm256_add_ps(_mm256_loadu_ps(cur + x - n), _mm256_loadu_ps(cur + x + n)));
+			laplacian = _mm256_fnmadd_ps(four, center, laplacian);
+
+			__m256 velocity = _mm256_sub_ps(center, _mm256_loadu_ps(next + x));
+			__m256 height = _mm256_fmadd_ps(vdamping, velocity, center);
+			height = _mm256_fmadd_ps(vcoupling, laplacian, height);
+
+			_mm256_storeu_ps(next + x, height);
+			vbound = _mm256_max_ps(vbound, _mm256_andnot_ps(sign, height));
+		}
+
+		__m128 half = _mm_max_ps(_mm256_castps256_ps128(vbound), _mm256_extractf128_ps(vbound, 1));
+		float lanes[4];
+		_mm_storeu_ps(lanes, half);
+		*bound = std::max(std::max(lanes[0], lanes[1]), std::max(lanes[2], lanes[3]));
+
+		return x;
+	}
+#endif
+
+	HeightfieldConfig config;
+	JobSystem* jobs;
+	SimdLevel simd;
+
+	// the two time levels, previous is overwritten with the next one every step
+	std::vector<float> current;
+	std::vector<float> previous;
+
+	float spacing;
+	float step_time;
+	float coupling;
+	float damping;
+	float pending = 0.0f;
+
+	size_t rows, columns;
+	std::vector<float> tile_bounds;
+	float height_bound = 0.0f;
+};
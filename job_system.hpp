@@ -0,0 +1,387 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#include "log.hpp"
+
+struct JobSystem;
+
+// Jobs not finished yet. Jobs started with a counter raise it until they are
+// done, wait() on it or start jobs after it. It can be reused or destroyed
+// once a wait() on it returned.
+struct JobCounter {
+
+	bool done() {
+		return pending.load(std::memory_order_acquire) == 0;
+	}
+
+private:
+	friend struct JobSystem;
+
+	struct Held {
+		std::function<void()> job;
+		JobCounter* counter;
+	};
+
+	std::atomic<int> pending{0};
+
+	// jobs started after this counter, held until it reaches zero
+	std::mutex mutex;
+	std::vector<Held> held;
+};
+
+// Worker threads that take jobs from their own deque, newest first while it
+// is warm in cache, and steal the oldest from the others when theirs is
+// empty. Threads that are not workers, the GL thread included, share one more
+// deque and take part in the work while they wait(). Work that has to touch
+// the GL context goes in a queue of its own, emptied by run_main() on the GL
+// thread once a frame.
+struct JobSystem {
+
+	using Job = std::function<void()>;
+
+	// threads counts the calling thread, a system of size one runs everything inline
+	JobSystem(size_t threads = std::thread::hardware_concurrency()) {
+		threads = std::max<size_t>(threads, 1);
+
+		queues = std::vector<Queue>(threads);
+		counters = std::vector<Stats>(threads);
+		start = std::chrono::steady_clock::now();
+
+		for (size_t i = 1; i < threads; i++)
+			workers.emplace_back([this, i] { work(i); });
+	}
+
+	~JobSystem() {
+		{
+			std::lock_guard<std::mutex> lock(sleep);
+			stopping = true;
+		}
+
+		wake.notify_all();
+
+		for (std::thread& worker : workers)
+			worker.join();
+	}
+
+	JobSystem(const JobSystem&) = delete;
+	JobSystem& operator=(const JobSystem&) = delete;
+
+	// Threads running jobs, the waiting caller included
+	size_t size() {
+		return workers.size() + 1;
+	}
+
+	// Starts job on any thread, counter counts it until it is done. With after,
+	// the job only starts once after is done. Without workers it runs right here.
+	void run(Job job, JobCounter* counter = nullptr, JobCounter* after = nullptr) {
+		if (counter)
+			counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+		if (after && !after->done()) {
+			std::lock_guard<std::mutex> lock(after->mutex);
+
+			// checked again under the lock the last job of after takes to release the held ones
+			if (!after->done()) {
+				after->held.push_back({std::move(job), counter});
+				return;
+			}
+		}
+
+		push({std::move(job), counter});
+	}
+
+	// Runs jobs until counter is done, this thread is never idle in the meantime
+	void wait(JobCounter& counter) {
+		const size_t slot = current_slot();
+		const uint64_t counted = counted_nanoseconds;
+		const auto begin = std::chrono::steady_clock::now();
+
+		while (!counter.done()) {
+			if (!run_one(slot))
+				std::this_thread::yield();
+		}
+
+		// the last job may still be releasing the ones held after it
+		{
+			std::lock_guard<std::mutex> lock(counter.mutex);
+		}
+
+		// a job waiting here is not busy, the jobs run meanwhile count for themselves.
+		// What they counted is within this wait, so it is not added again.
+		counted_nanoseconds = counted + std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+	}
+
+	// Calls job(begin, end) on chunks of at most grain items covering [0, count),
+	// one job each, returns once every chunk is done
+	void parallel_for(size_t count, size_t grain, const std::function<void(size_t, size_t)>& job) {
+		if (count == 0)
+			return;
+
+		grain = std::max<size_t>(grain, 1);
+
+		// too many small jobs cost more than they spread, larger chunks then
+		grain = std::max(grain, (count + MAX_CHUNKS_PER_THREAD * size() - 1) / (MAX_CHUNKS_PER_THREAD * size()));
+
+		if (workers.empty() || count <= grain) {
+			job(0, count);
+			return;
+		}
+
+		JobCounter counter;
+
+		// the last chunk runs here, the others are there to be stolen meanwhile
+		size_t begin = 0;
+
+		for (; begin + grain < count; begin += grain) {
+			const size_t end = begin + grain;
+			run([&job, begin, end] { job(begin, end); }, &counter);
+		}
+
+		job(begin, count);
+		wait(counter);
+	}
+
+	// Runs job on the thread that calls run_main(), for work on the GL context.
+	// wait() does not run these, only wait on their counter after run_main().
+	void run_on_main(Job job, JobCounter* counter = nullptr) {
+		if (counter)
+			counter->pending.fetch_add(1, std::memory_order_relaxed);
+
+		std::lock_guard<std::mutex> lock(main_mutex);
+		main_jobs.push_back({std::move(job), counter});
+	}
+
+	// Runs the GL jobs queued so far, call once a frame on the GL thread.
+	// Jobs they queue wait for the next call. Returns how many ran.
+	size_t run_main() {
+		std::vector<Task> jobs;
+
+		{
+			std::lock_guard<std::mutex> lock(main_mutex);
+			jobs.swap(main_jobs);
+		}
+
+		for (Task& task : jobs)
+			execute(task, 0, false);
+
+		return jobs.size();
+	}
+
+	// Per thread numbers since the start or reset_stats(), slot 0 is every thread
+	// that is not a worker. busy is time in jobs, less what they spent in wait()
+	// or running other jobs inline.
+	struct WorkerStats {
+		size_t jobs;
+		size_t steals;
+		double busy;
+		double utilization;
+	};
+
+	std::vector<WorkerStats> stats() {
+		const double elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+		std::vector<WorkerStats> result;
+
+		for (Stats& counter : counters) {
+			const double busy = counter.busy_nanoseconds.load(std::memory_order_relaxed) * 1e-9;
+			result.push_back({counter.jobs.load(std::memory_order_relaxed), counter.steals.load(std::memory_order_relaxed), busy, elapsed > 0.0 ? busy / elapsed : 0.0});
+		}
+
+		return result;
+	}
+
+	void reset_stats() {
+		for (Stats& counter : counters) {
+			counter.jobs = 0;
+			counter.steals = 0;
+			counter.busy_nanoseconds = 0;
+		}
+
+		start = std::chrono::steady_clock::now();
+	}
+
+	void log_stats() {
+		std::vector<WorkerStats> all = stats();
+
+		for (size_t i = 0; i < all.size(); i++) {
+			gl_log("jobs %s %zu: %zu jobs, %zu stolen, %.3f s busy, %.1f%% utilization\n",
+				i ? "worker" : "main", i, all[i].jobs, all[i].steals, all[i].busy, 100.0 * all[i].utilization);
+		}
+	}
+
+private:
+	// more chunks than this per thread in a parallel_for are merged
+	static constexpr size_t MAX_CHUNKS_PER_THREAD = 64;
+
+	struct Task {
+		Job job;
+		JobCounter* counter;
+	};
+
+	// owners take from the back, thieves from the front
+	struct alignas(64) Queue {
+		std::mutex mutex;
+		std::deque<Task> tasks;
+	};
+
+	struct alignas(64) Stats {
+		std::atomic<size_t> jobs{0};
+		std::atomic<size_t> steals{0};
+		std::atomic<uint64_t> busy_nanoseconds{0};
+	};
+
+	// Queue of the calling thread, 0 unless it is one of this system's workers
+	size_t current_slot() {
+		return worker_system == this ? worker_slot : 0;
+	}
+
+	void push(Task task) {
+		// nobody else would ever take it
+		if (workers.empty()) {
+			execute(task, 0, false);
+			return;
+		}
+
+		Queue& queue = queues[current_slot()];
+
+		{
+			std::lock_guard<std::mutex> lock(queue.mutex);
+			queue.tasks.push_back(std::move(task));
+		}
+
+		queued.fetch_add(1, std::memory_order_release);
+
+		// taking the lock orders this with a worker about to sleep, it sees queued first
+		{
+			std::lock_guard<std::mutex> lock(sleep);
+		}
+
+		wake.notify_one();
+	}
+
+	// Runs one job from slot's queue or stolen from another, false if there was none
+	bool run_one(size_t slot) {
+		Task task;
+		bool stolen = false;
+
+		if (!take(queues[slot], task, true)) {
+			const size_t count = queues.size();
+			const size_t first = steal_start.fetch_add(1, std::memory_order_relaxed);
+
+			for (size_t i = 0; i < count && !stolen; i++) {
+				const size_t victim = (first + i) % count;
+
+				if (victim != slot)
+					stolen = take(queues[victim], task, false);
+			}
+
+			if (!stolen)
+				return false;
+		}
+
+		execute(task, slot, stolen);
+		return true;
+	}
+
+	bool take(Queue& queue, Task& task, bool newest) {
+		std::lock_guard<std::mutex> lock(queue.mutex);
+
+		if (queue.tasks.empty())
+			return false;
+
+		if (newest) {
+			task = std::move(queue.tasks.back());
+			queue.tasks.pop_back();
+		} else {
+			task = std::move(queue.tasks.front());
+			queue.tasks.pop_front();
+		}
+
+		queued.fetch_sub(1, std::memory_order_relaxed);
+		return true;
+	}
+
+	void execute(Task& task, size_t slot, bool stolen) {
+		const uint64_t counted = counted_nanoseconds;
+		auto begin = std::chrono::steady_clock::now();
+		task.job();
+		auto end = std::chrono::steady_clock::now();
+
+		// waits and jobs run inline within this one are not its own time
+		const int64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(end - begin).count();
+		const int64_t busy = std::max<int64_t>(elapsed - (int64_t)(counted_nanoseconds - counted), 0);
+		counted_nanoseconds = counted + elapsed;
+
+		Stats& counter = counters[slot];
+		counter.jobs.fetch_add(1, std::memory_order_relaxed);
+		counter.steals.fetch_add(stolen, std::memory_order_relaxed);
+		counter.busy_nanoseconds.fetch_add(busy, std::memory_order_relaxed);
+
+		if (task.counter)
+			finish(*task.counter);
+	}
+
+	// The job of a counter is done, the last one starts what was held after it
+	void finish(JobCounter& counter) {
+		std::vector<JobCounter::Held> held;
+
+		// under the lock, so wait() cannot return while this still holds it
+		{
+			std::lock_guard<std::mutex> lock(counter.mutex);
+
+			if (counter.pending.fetch_sub(1, std::memory_order_acq_rel) != 1)
+				return;
+
+			held.swap(counter.held);
+		}
+
+		// their counters already count them
+		for (JobCounter::Held& job : held)
+			push({std::move(job.job), job.counter});
+	}
+
+	void work(size_t slot) {
+		worker_system = this;
+		worker_slot = slot;
+
+		while (true) {
+			if (run_one(slot))
+				continue;
+
+			std::unique_lock<std::mutex> lock(sleep);
+			wake.wait(lock, [this] { return stopping || queued.load(std::memory_order_acquire) > 0; });
+
+			if (stopping)
+				return;
+		}
+	}
+
+	static inline thread_local JobSystem* worker_system = nullptr;
+	static inline thread_local size_t worker_slot = 0;
+	// time this thread spent in wait() or in jobs already counted, taken out of
+	// the busy time of the job around it
+	static inline thread_local uint64_t counted_nanoseconds = 0;
+
+	std::vector<std::thread> workers;
+	std::vector<Queue> queues;
+	std::vector<Stats> counters;
+	std::chrono::steady_clock::time_point start;
+
+	std::atomic<size_t> queued{0};
+	std::atomic<size_t> steal_start{0};
+
+	std::mutex sleep;
+	std::condition_variable wake;
+	bool stopping = false;
+
+	std::mutex main_mutex;
+	std::vector<Task> main_jobs;
+};
@@ -3,96 +3,454 @@
 #include <iostream>
 #include <fstream>
 #include <cassert>
+#include <cstdlib>
+#include <chrono>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
 #include <stdarg.h>
+#include <string.h>
 #include <time.h>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include "ring.hpp"
+
 #define GL_LOG_FILE "gl.log"
 
-#define GL_CALL(x)\
-	gl_clear_error();\
-	x;\
-	assert(gl_check_error(#x, __FILE__, __LINE__))
+// How much GL_CALL checks, chosen at compile time with -DGL_CHECK=...
+//
+//   GL_CHECK_OFF      the bare call
+//   GL_CHECK_SAMPLED  every call counted, one in GL_CHECK_INTERVAL timed and checked
+//   GL_CHECK_FULL     every call counted, timed and checked, errors abort
+//
+// Errors come from the KHR_debug callback when the context has one and from
+// glGetError after the call otherwise. Debug builds default to full and NDEBUG
+// builds to sampled, so release builds still notice errors.
+#define GL_CHECK_OFF 0
+#define GL_CHECK_SAMPLED 1
+#define GL_CHECK_FULL 2
+
+#ifndef GL_CHECK
+#ifdef NDEBUG
+#define GL_CHECK GL_CHECK_SAMPLED
+#else
+#define GL_CHECK GL_CHECK_FULL
+#endif
+#endif
+
+#ifndef GL_CHECK_INTERVAL
+#define GL_CHECK_INTERVAL 64
+#endif
+
+#if GL_CHECK == GL_CHECK_OFF
+#define GL_CALL(x) do { x; } while (0)
+#else
+#define GL_CALL(x) do { \
+	static GlCallSite gl_call_site(#x, __FILE__, __LINE__); \
+	bool gl_call_checked = gl_call_begin(&gl_call_site); \
+	x; \
+	if (gl_call_checked) \
+		gl_call_end(&gl_call_site); \
+} while (0)
+#endif
 
 void gl_clear_error() {
 	while (glGetError() != GL_NO_ERROR);
 }
 
-bool gl_check_error(const char* function, const char* file, int line) {
-	while (GLenum error = glGetError()) {
-		std::cout << "[OpenGL Error] (" << error << ") " << function << " " << file << ":" << line << std::endl;
-		return false;
+enum class LogLevel {
+	DEBUG,
+	INFO,
+	WARNING,
+	ERROR,
+};
+
+enum class LogFormat {
+	// the messages as they are
+	TEXT,
+	// one JSON object per message with time, level and thread
+	JSON,
+};
+
+// Messages are formatted on the calling thread into a fixed size record and
+// pushed on a lock-free ring; a writer thread drains it every few milliseconds
+// and writes the batch with one call. Callers never block or make a system
+// call, a full ring drops the message and the writer says how many it lost.
+// Messages longer than a record go as several.
+struct Logger {
+
+	static constexpr size_t RECORDS = 1024;
+	static constexpr size_t TEXT = 496;
+
+	Logger() : ring(RECORDS) {
+		file = fopen(GL_LOG_FILE, "a");
+
+		if (!file)
+			std::cerr << "ERROR: could not open GL_LOG_FILE " << GL_LOG_FILE << " file for appending" << std::endl;
+
+		writer = std::thread([this] { write(); });
 	}
 
-	return true;
-}
+	~Logger() {
+		stopping.store(true);
+		writer.join();
 
-bool restart_gl_log() {
-	std::fstream file;
+		if (file)
+			fclose(file);
+	}
 
-	file.open(GL_LOG_FILE, std::ios::out);
+	bool log(LogLevel level, const char* message, va_list arguments) {
+		if (level < minimum)
+			return true;
 
-	if (!file) {
-		std::cerr << "ERROR: could not open GL_LOG_FILE log file " << GL_LOG_FILE << " for writing" << std::endl;
-		return false;
+		char text[4096];
+		int length = vsnprintf(text, sizeof(text), message, arguments);
+		length = std::min<int>(std::max(length, 0), sizeof(text) - 1);
+
+		return push(level, text, length, false);
 	}
 
-	time_t now = time(NULL);
-	char* date = ctime(&now);
+	// Empties the file, in order with the messages around it
+	bool restart() {
+		return push(LogLevel::INFO, "", 0, true);
+	}
 
-	std::cout << "GL_LOG_FILE log. local time " << date << std::endl;
+	// Waits until everything logged so far is on disk, for fatal errors
+	void flush() {
+		size_t target = pushed.load();
 
-	file.close();
+		while (written.load() < target && !stopping.load())
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
 
-	return true;
+	LogLevel minimum = LogLevel::DEBUG;
+	LogFormat format = LogFormat::TEXT;
+
+private:
+	struct Record {
+		int64_t time;
+		LogLevel level;
+		uint32_t thread;
+		uint16_t length;
+		bool restart;
+		char text[TEXT];
+	};
+
+	bool push(LogLevel level, const char* text, int length, bool restart) {
+		static std::atomic<uint32_t> threads{0};
+		thread_local uint32_t thread = threads++;
+
+		Record record;
+		record.time = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::system_clock::now().time_since_epoch()).count();
+		record.level = level;
+		record.thread = thread;
+		record.restart = restart;
+
+		int offset = 0;
+
+		do {
+			record.length = std::min<int>(length - offset, TEXT);
+			memcpy(record.text, text + offset, record.length);
+			offset += record.length;
+
+			if (!ring.push(record))
+				return false;
+
+			pushed++;
+		} while (offset < length);
+
+		return true;
+	}
+
+	void write() {
+		std::string batch;
+		size_t reported = 0;
+
+		while (true) {
+			bool last = stopping.load();
+
+			Record record;
+			size_t count = 0;
+
+			while (ring.pop(record)) {
+				count++;
+
+				if (record.restart) {
+					emit(batch);
+
+					if (file)
+						file = freopen(GL_LOG_FILE, "w", file);
+
+					continue;
+				}
+
+				append(batch, record);
+
+				if (record.level == LogLevel::ERROR)
+					fwrite(record.text, 1, record.length, stderr);
+			}
+
+			if (ring.lost() > reported) {
+				char text[64];
+				int length = snprintf(text, sizeof(text), "[log] %zu messages dropped\n", ring.lost() - reported);
+				batch.append(text, length);
+				reported = ring.lost();
+			}
+
+			emit(batch);
+			written += count;
+
+			if (last)
+				return;
+
+			std::this_thread::sleep_for(std::chrono::milliseconds(5));
+		}
+	}
+
+	void append(std::string& batch, const Record& record) {
+		if (format == LogFormat::TEXT) {
+			batch.append(record.text, record.length);
+			return;
+		}
+
+		static const char* levels[] = {"debug", "info", "warning", "error"};
+
+		char prefix[128];
+		int length = snprintf(prefix, sizeof(prefix), "{\"time_us\":%lld,\"level\":\"%s\",\"thread\":%u,\"message\":\"",
+			(long long)record.time, levels[(int)record.level], record.thread);
+		batch.append(prefix, length);
+
+		for (size_t i = 0; i < record.length; i++) {
+			char c = record.text[i];
+
+			if (c == '"' || c == '\\') {
+				batch += '\\';
+				batch += c;
+			} else if (c == '\n') {
+				batch += "\\n";
+			} else if ((unsigned char)c < 0x20) {
+				char escaped[8];
+				snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+				batch += escaped;
+			} else {
+				batch += c;
+			}
+		}
+
+		batch += "\"}\n";
+	}
+
+	void emit(std::string& batch) {
+		if (file && !batch.empty()) {
+			fwrite(batch.data(), 1, batch.size(), file);
+			fflush(file);
+		}
+
+		batch.clear();
+	}
+
+	MpscRing<Record> ring;
+	FILE* file;
+	std::thread writer;
+
+	std::atomic<bool> stopping{false};
+	std::atomic<size_t> pushed{0};
+	std::atomic<size_t> written{0};
+};
+
+Logger& logger() {
+	static Logger instance;
+	return instance;
+}
+
+bool gl_log_at(LogLevel level, const char* message, ...) {
+	va_list argptr;
+
+	va_start(argptr, message);
+	bool logged = logger().log(level, message, argptr);
+	va_end(argptr);
+
+	return logged;
 }
 
 bool gl_log(const char* message, ...) {
 	va_list argptr;
 
-	// FIXME: use fstrem instead of fopen
-	FILE* file = fopen(GL_LOG_FILE, "a");
+	va_start(argptr, message);
+	bool logged = logger().log(LogLevel::INFO, message, argptr);
+	va_end(argptr);
 
-	if (!file) {
-		std::cerr << "ERROR: could not open GL_LOG_FILE " << GL_LOG_FILE << " file for appending" << std::endl;
-		return false;
-	}
+	return logged;
+}
+
+// Also echoed on stderr, by the writer
+bool gl_log_error(const char* message, ...) {
+	va_list argptr;
 
 	va_start(argptr, message);
-	vfprintf(file, message, argptr);
+	bool logged = logger().log(LogLevel::ERROR, message, argptr);
 	va_end(argptr);
 
-	fclose(file);
+	return logged;
+}
+
+bool restart_gl_log() {
+	time_t now = time(NULL);
+
+	logger().restart();
+	gl_log("GL_LOG_FILE log. local time %s\n", ctime(&now));
 
 	return true;
 }
 
-bool gl_log_error(const char* message, ...) {
-	va_list argptr;
+// Counters of one GL_CALL in the source
+struct GlCallSite {
+	const char* call;
+	const char* file;
+	int line;
+
+	size_t calls = 0;
+	size_t timed = 0;
+	size_t errors = 0;
+	int64_t nanoseconds = 0;
+
+	std::chrono::steady_clock::time_point started;
 
-	// FIXME: use fstrem instead of fopen
-	FILE* file = fopen(GL_LOG_FILE, "a");
+	GlCallSite(const char* call, const char* file, int line);
 
-	if (!file) {
-		std::cerr << "ERROR: could not open GL_LOG_FILE " << GL_LOG_FILE << " file for appending" << std::endl;
+	// time spent in all calls, the timed ones stand for the rest
+	double estimated_seconds() const {
+		return timed ? nanoseconds * 1e-9 * calls / timed : 0.0;
+	}
+};
+
+std::vector<GlCallSite*>& gl_call_sites() {
+	static std::vector<GlCallSite*> sites;
+	return sites;
+}
+
+GlCallSite::GlCallSite(const char* call, const char* file, int line) : call(call), file(file), line(line) {
+	gl_call_sites().push_back(this);
+}
+
+// the debug callback reports errors, and the site they happened in when synchronous
+static bool gl_debug_callback_installed = false;
+static bool gl_debug_synchronous = false;
+static GlCallSite* gl_current_site = nullptr;
+
+bool gl_call_begin(GlCallSite* site) {
+	site->calls++;
+
+	if (GL_CHECK == GL_CHECK_SAMPLED && (site->calls - 1) % GL_CHECK_INTERVAL != 0)
 		return false;
+
+	gl_current_site = site;
+	site->started = std::chrono::steady_clock::now();
+
+	return true;
+}
+
+void gl_call_error(GlCallSite* site, GLenum error, const char* message) {
+	if (site) {
+		site->errors++;
+		gl_log_error("[OpenGL Error] (0x%x) %s %s:%i %s\n", error, site->call, site->file, site->line, message);
+	} else {
+		gl_log_error("[OpenGL Error] (0x%x) %s\n", error, message);
 	}
 
-	va_start(argptr, message);
-	vfprintf(file, message, argptr);
-	va_end(argptr);
+	// not an assert, NDEBUG builds that ask for full checking abort too
+	if (GL_CHECK == GL_CHECK_FULL) {
+		logger().flush();
+		std::abort();
+	}
+}
 
-	va_start(argptr, message);
-	vfprintf(stderr, message, argptr);
-	va_end(argptr);
+void gl_call_end(GlCallSite* site) {
+	site->nanoseconds += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - site->started).count();
+	site->timed++;
+
+	gl_current_site = nullptr;
+
+	if (gl_debug_callback_installed)
+		return;
+
+	// errors of unchecked calls in between land here too when sampling
+	while (GLenum error = glGetError())
+		gl_call_error(site, error, "");
+}
+
+void GLAPIENTRY gl_debug_callback(GLenum source, GLenum type, GLuint id, GLenum severity, GLsizei, const GLchar* message, const void*) {
+	// a shader that does not compile is not a misuse of the API, the info log has it
+	// asynchronous output comes late, the current site is some later call then
+	if (type == GL_DEBUG_TYPE_ERROR && source != GL_DEBUG_SOURCE_SHADER_COMPILER) {
+		gl_call_error(gl_debug_synchronous ? gl_current_site : nullptr, id, message);
+		return;
+	}
+
+	if (severity != GL_DEBUG_SEVERITY_NOTIFICATION)
+		gl_log("[OpenGL Debug] %s\n", message);
+}
+
+// Moves error reporting to the debug callback when the context is a debug
+// context, only those have to produce messages, others keep polling. In full
+// checking the output is synchronous, so errors reach the call that made them.
+bool gl_debug_setup() {
+	if (GL_CHECK == GL_CHECK_OFF)
+		return false;
+
+	GLint flags = 0;
+	glGetIntegerv(GL_CONTEXT_FLAGS, &flags);
 
-	fclose(file);
+	if (!(flags & GL_CONTEXT_FLAG_DEBUG_BIT)) {
+		gl_log("no debug context, GL_CALL polls glGetError\n");
+		return false;
+	}
+
+	if (GLEW_KHR_debug) {
+		glDebugMessageCallback(gl_debug_callback, nullptr);
+		glEnable(GL_DEBUG_OUTPUT);
+	} else if (GLEW_ARB_debug_output) {
+		glDebugMessageCallbackARB(gl_debug_callback, nullptr);
+	} else {
+		gl_log("no debug output, GL_CALL polls glGetError\n");
+		return false;
+	}
+
+	if (GL_CHECK == GL_CHECK_FULL) {
+		glEnable(GL_DEBUG_OUTPUT_SYNCHRONOUS);
+		gl_debug_synchronous = true;
+	}
+
+	gl_debug_callback_installed = true;
+	gl_log("GL_CALL errors through the debug callback\n");
 
 	return true;
 }
 
+// The GL_CALL sites by estimated time into the log, the ones never reached left out
+void gl_call_report(size_t count = 20) {
+	std::vector<GlCallSite*> sites;
+
+	for (GlCallSite* site : gl_call_sites())
+		if (site->calls)
+			sites.push_back(site);
+
+	std::sort(sites.begin(), sites.end(), [](GlCallSite* a, GlCallSite* b) {
+		return a->estimated_seconds() > b->estimated_seconds();
+	});
+
+	gl_log("%10s %8s %10s  %s\n", "calls", "errors", "ms", "call");
+
+	for (size_t i = 0; i < sites.size() && i < count; i++) {
+		GlCallSite* site = sites[i];
+		gl_log("%10zu %8zu %10.3f  %s %s:%i\n", site->calls, site->errors, site->estimated_seconds() * 1e3, site->call, site->file, site->line);
+	}
+}
+
 void glfw_error_callback(int error, const char* description) {
 	gl_log_error("GLFW ERROR: code %i msg: %s\n", error, description);
 }
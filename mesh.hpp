@@ -1,11 +1,15 @@
 #pragma once
 
 #include <cassert>
+#include <cstdint>
+#include <type_traits>
+#include <vector>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
 #include "log.hpp"
+#include "vertex_format.hpp"
 
 struct Mesh {
 
@@ -25,12 +29,17 @@ struct Mesh {
 	~Mesh() {
 		GL_CALL(glDeleteBuffers(1, &vbo));
 		GL_CALL(glDeleteBuffers(1, &ibo));
+
+		if (instance_vbo && !external_instances) {
+			GL_CALL(glDeleteBuffers(1, &instance_vbo));
+		}
+
 		GL_CALL(glDeleteVertexArrays(1, &vao));
 	}
 
+	// The element buffer is part of the vertex array, it comes along
 	void bind() {
 		GL_CALL(glBindVertexArray(vao));
-		GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo));
 		bound = true;
 	}
 
@@ -48,27 +57,242 @@ struct Mesh {
 	}
 
 	void indices(GLsizeiptr size, const unsigned int* data, GLenum usage) {
-		GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo));
-		GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage));
-		index_count = size / sizeof(unsigned int);
+		index_data(size, data, usage, GL_UNSIGNED_INT, sizeof(unsigned int));
+	}
+
+	// Storage for size bytes of vertices, mapped for writing until unmap_data(),
+	// the memory can be filled from any thread, the GL calls stay on this one
+	void* map_data(GLsizeiptr size, GLenum usage) {
+		GL_CALL(glBindVertexArray(vao));
+		GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+		GL_CALL(glBufferData(GL_ARRAY_BUFFER, size, nullptr, usage));
+		GL_CALL(data_mapping = glMapBufferRange(GL_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+		vertex_count = size / sizeof(float); // FIXME: this is wrong
+
+		bound = true;
+		return data_mapping;
+	}
+
+	// False when the driver lost the contents while mapped, they have to be written again
+	bool unmap_data() {
+		return unmap(GL_ARRAY_BUFFER, vbo, data_mapping);
+	}
+
+	// Same as map_data for size bytes of unsigned int indices, until unmap_indices()
+	unsigned int* map_indices(GLsizeiptr size, GLenum usage) {
+		index_data(size, nullptr, usage, GL_UNSIGNED_INT, sizeof(unsigned int));
+		GL_CALL(index_mapping = glMapBufferRange(GL_ELEMENT_ARRAY_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT));
+
+		return (unsigned int*)index_mapping;
+	}
+
+	bool unmap_indices() {
+		GL_CALL(glBindVertexArray(vao));
+		return unmap(GL_ELEMENT_ARRAY_BUFFER, ibo, index_mapping);
+	}
+
+	// Half the size, for meshes or chunks of at most 65535 vertices
+	void indices(GLsizeiptr size, const uint16_t* data, GLenum usage) {
+		index_data(size, data, usage, GL_UNSIGNED_SHORT, sizeof(uint16_t));
+	}
+
+	// The largest index of the index type ends a strip and starts the next one
+	void primitive_restart(bool enabled) {
+		restart = enabled;
+	}
+
+	// Part of the index buffer drawn with its indices offset by base_vertex
+	struct Chunk {
+		GLsizei count;
+		size_t first;
+		GLint base_vertex;
+	};
+
+	// Draws these chunks in one call instead of the whole index buffer, after indices()
+	void chunks(const std::vector<Chunk>& chunks) {
+		chunk_counts.clear();
+		chunk_offsets.clear();
+		chunk_base_vertices.clear();
+
+		for (const Chunk& chunk : chunks) {
+			chunk_counts.push_back(chunk.count);
+			chunk_offsets.push_back((const void*)(chunk.first * index_size));
+			chunk_base_vertices.push_back(chunk.base_vertex);
+		}
+	}
+
+	// Per instance data in a buffer of its own, count instances are drawn
+	void instance_data(GLsizeiptr size, const void* data, GLenum usage, GLsizei count) {
+		if (!instance_vbo) {
+			GL_CALL(glGenBuffers(1, &instance_vbo));
+		}
+
+		GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, instance_vbo));
+		GL_CALL(glBufferData(GL_ARRAY_BUFFER, size, data, usage));
+		instance_count = count;
+	}
+
+	// Per instance data read from a buffer made elsewhere, like a StreamBuffer
+	void instance_buffer(GLuint buffer) {
+		assert(!instance_vbo && "Mesh already has instance data");
+		instance_vbo = buffer;
+		external_instances = true;
+	}
+
+	// Points the instance attributes offset bytes into the instance buffer, count instances are drawn
+	void instance_offset(GLintptr offset, GLsizei count) {
+		assert(bound && "Mesh not bound");
+
+		GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, instance_vbo));
+
+		for (const InstanceAttribute& attribute : instance_layout) {
+			GL_CALL(glVertexAttribPointer(attribute.id, attribute.size, attribute.type, attribute.normalized, attribute.stride, (const void*)(offset + attribute.offset)));
+		}
+
+		instance_count = count;
 	}
 
 	// TODO: move layout setup to a different class
+	// size components of type T, read as floats, see vertex_format.hpp for the types
 	template<typename T>
 	void attributes(GLint size, bool normalized, GLsizei stride) {
-		assert(false);
+		attribute(VertexType<T>::type, size, attribute_bytes<T>(size), normalized, false, stride);
+	}
+
+	// size integer components read as int or uint in the shader, never converted
+	template<typename T>
+	void integer_attributes(GLint size, GLsizei stride) {
+		static_assert(std::is_integral<T>::value, "Integer attributes need an integer type");
+		attribute(VertexType<T>::type, size, attribute_bytes<T>(size), false, true, stride);
+	}
+
+	// Forgets the layout, attributes set after this start again at location 0
+	void clear_attributes() {
+		assert(bound && "Mesh not bound");
+
+		for (size_t id = 0; id < attribute_id; id++) {
+			GL_CALL(glDisableVertexAttribArray(id));
+			GL_CALL(glVertexAttribDivisor(id, 0));
+		}
+
+		attribute_id = 0;
+		pointer = nullptr;
+		instance_pointer = nullptr;
+		instance_layout.clear();
+	}
+
+	// Same as attributes, read from the instance buffer and advanced once per instance
+	template<typename T>
+	void instance_attributes(GLint size, bool normalized, GLsizei stride) {
+		assert(bound && "Mesh not bound");
+		assert(instance_vbo && "Mesh has no instance data");
+
+		const GLenum type = VertexType<T>::type;
+		const auto glnormalized = normalized ? GL_TRUE : GL_FALSE;
+
+		GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, instance_vbo));
+		GL_CALL(glEnableVertexAttribArray(attribute_id));
+		GL_CALL(glVertexAttribPointer(attribute_id, size, type, glnormalized, stride, instance_pointer));
+		GL_CALL(glVertexAttribDivisor(attribute_id, 1));
+
+		instance_layout.push_back({(GLuint)attribute_id++, size, type, (GLboolean)glnormalized, stride, (size_t)instance_pointer});
+
+		instance_pointer = (const void*)((size_t)instance_pointer + attribute_bytes<T>(size));
 	}
 	void mode(GLenum draw_mode) {
 		this->draw_mode = draw_mode;
 	}
 
+	// Vertices per patch when the mode is GL_PATCHES
+	void patch_vertices(GLint count) {
+		patch_size = count;
+	}
+
+	// Draw without any vertex data, the shader builds positions from gl_VertexID and gl_InstanceID
+	void attributeless(GLsizei vertices, GLsizei instances = 1) {
+		arrays_count = vertices;
+		instance_count = instances;
+		indexed = false;
+	}
+
+	// A grid of columns x rows cells as GL_TRIANGLES, one instance per row and six vertices per cell
+	void grid(GLsizei columns, GLsizei rows) {
+		attributeless(6 * columns, rows);
+		mode(GL_TRIANGLES);
+	}
+
+	GLuint id() {
+		return vao;
+	}
+
 	void draw() {
 		assert(bound && "Mesh not bound");
-		GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo));
-		GL_CALL(glDrawElements(draw_mode, index_count, GL_UNSIGNED_INT, nullptr));
+
+		if (draw_mode == GL_PATCHES) {
+			GL_CALL(glPatchParameteri(GL_PATCH_VERTICES, patch_size));
+		}
+
+		if (!indexed) {
+			GL_CALL(glDrawArraysInstanced(draw_mode, 0, arrays_count, instance_count));
+			return;
+		}
+
+		// not part of the vertex array, on only for this draw
+		if (restart) {
+			GL_CALL(glEnable(GL_PRIMITIVE_RESTART));
+			GL_CALL(glPrimitiveRestartIndex(index_type == GL_UNSIGNED_SHORT ? 0xffff : 0xffffffff));
+		}
+
+		if (!chunk_counts.empty()) {
+			GL_CALL(glMultiDrawElementsBaseVertex(draw_mode, chunk_counts.data(), index_type, chunk_offsets.data(), chunk_counts.size(), chunk_base_vertices.data()));
+		} else if (instance_vbo) {
+			GL_CALL(glDrawElementsInstanced(draw_mode, index_count, index_type, nullptr, instance_count));
+		} else {
+			GL_CALL(glDrawElements(draw_mode, index_count, index_type, nullptr));
+		}
+
+		if (restart) {
+			GL_CALL(glDisable(GL_PRIMITIVE_RESTART));
+		}
 	}
 
 private:
+	bool unmap(GLenum target, GLuint buffer, void*& mapping) {
+		if (!mapping)
+			return false;
+
+		GLboolean kept;
+		GL_CALL(glBindBuffer(target, buffer));
+		GL_CALL(kept = glUnmapBuffer(target));
+		mapping = nullptr;
+
+		return kept == GL_TRUE;
+	}
+
+	void index_data(GLsizeiptr size, const void* data, GLenum usage, GLenum type, size_t bytes) {
+		GL_CALL(glBindVertexArray(vao));
+		GL_CALL(glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo));
+		GL_CALL(glBufferData(GL_ELEMENT_ARRAY_BUFFER, size, data, usage));
+		index_count = size / bytes;
+		index_type = type;
+		index_size = bytes;
+	}
+
+	void attribute(GLenum type, GLint size, size_t bytes, bool normalized, bool integer, GLsizei stride) {
+		assert(bound && "Mesh not bound");
+
+		GL_CALL(glBindBuffer(GL_ARRAY_BUFFER, vbo));
+		GL_CALL(glEnableVertexAttribArray(attribute_id));
+
+		if (integer) {
+			GL_CALL(glVertexAttribIPointer(attribute_id++, size, type, stride, pointer));
+		} else {
+			GL_CALL(glVertexAttribPointer(attribute_id++, size, type, normalized ? GL_TRUE : GL_FALSE, stride, pointer));
+		}
+
+		pointer = (const void*)((size_t)pointer + bytes);
+	}
+
 	GLuint vao;
 
 	GLuint vbo;
@@ -77,22 +301,41 @@ private:
 	size_t attribute_id = 0;
 	const void* pointer = nullptr;
 
+	void* data_mapping = nullptr;
+
 	GLuint ibo;
 	size_t index_count;
+	void* index_mapping = nullptr;
+	GLenum index_type = GL_UNSIGNED_INT;
+	size_t index_size = sizeof(unsigned int);
+	bool restart = false;
 
-	GLenum draw_mode;
+	std::vector<GLsizei> chunk_counts;
+	std::vector<const void*> chunk_offsets;
+	std::vector<GLint> chunk_base_vertices;
 
-	bool bound = false;
-};
+	GLuint instance_vbo = 0;
+	const void* instance_pointer = nullptr;
+	bool external_instances = false;
+
+	// kept to move the instance attributes with instance_offset()
+	struct InstanceAttribute {
+		GLuint id;
+		GLint size;
+		GLenum type;
+		GLboolean normalized;
+		GLsizei stride;
+		size_t offset;
+	};
 
-template<>
-void Mesh::attributes<float>(GLint size, bool normalized, GLsizei stride) {
-	assert(bound && "Mesh not bound");
+	std::vector<InstanceAttribute> instance_layout;
 
-	const auto glnormalized = normalized ? GL_TRUE : GL_FALSE;
+	GLenum draw_mode;
+	GLint patch_size = 3;
 
-	GL_CALL(glEnableVertexAttribArray(attribute_id));
-	GL_CALL(glVertexAttribPointer(attribute_id++, size, GL_FLOAT, glnormalized, stride, pointer));
+	bool indexed = true;
+	GLsizei arrays_count = 0;
+	GLsizei instance_count = 0;
 
-	pointer = (const void*)((size_t)pointer + size * sizeof(GLfloat));
-}
+	bool bound = false;
+};
@@ -0,0 +1,338 @@
+#pragma once
+
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+// Reordering of indexed triangle lists for the GPU, and numbers to tell how
+// well an order does. Every vertex a triangle needs that is not among the
+// last few shaded ones goes through the vertex shader again, rows of the plane
+// are much longer than that window, so in row order nearly every vertex is
+// shaded twice.
+//
+//   ACMR   vertices shaded per triangle, 3 at worst, about 0.5 on a big grid
+//   ATVR   vertices shaded per vertex, 1 is the least possible
+
+// The post-transform cache modern GPUs behave like, a FIFO of this many vertices
+const size_t VERTEX_CACHE_SIZE = 16;
+
+struct VertexCacheStats {
+	size_t transformed;
+	double acmr;
+	double atvr;
+};
+
+// Shading cost of an order, simulated with a FIFO of cache_size entries
+inline VertexCacheStats analyze_vertex_cache(const unsigned int* indices, size_t index_count, size_t vertex_count, size_t cache_size = VERTEX_CACHE_SIZE) {
+	// when each vertex last went in, it is still cached while fewer than cache_size went in since
+	std::vector<size_t> inserted(vertex_count, 0);
+	size_t time = cache_size + 1;
+	size_t transformed = 0;
+
+	for (size_t i = 0; i < index_count; i++) {
+		const unsigned int vertex = indices[i];
+
+		if (time - inserted[vertex] > cache_size) {
+			inserted[vertex] = time++;
+			transformed++;
+		}
+	}
+
+	const size_t triangles = index_count / 3;
+
+	return {transformed, triangles ? (double)transformed / triangles : 0.0, vertex_count ? (double)transformed / vertex_count : 0.0};
+}
+
+// Tipsify, Sander, Nehab and Barczak 2007: fans around one vertex at a time and
+// moves on to a neighbour still in the cache, the one with the fewest triangles
+// left so it is finished before it drops out. Linear in the triangle count.
+inline void optimize_vertex_cache(unsigned int* indices, size_t index_count, size_t vertex_count, size_t cache_size = VERTEX_CACHE_SIZE) {
+	const size_t triangle_count = index_count / 3;
+
+	// triangles of each vertex, as offsets into one array
+	std::vector<unsigned int> offsets(vertex_count + 1, 0);
+
+	for (size_t i = 0; i < index_count; i++)
+		offsets[indices[i] + 1]++;
+
+	for (size_t v = 0; v < vertex_count; v++)
+		offsets[v + 1] += offsets[v];
+
+	std::vector<unsigned int> adjacency(index_count);
+	std::vector<unsigned int> fill(offsets.begin(), offsets.end() - 1);
+
+	for (size_t i = 0; i < index_count; i++)
+		adjacency[fill[indices[i]]++] = i / 3;
+
+	// triangles not emitted yet around each vertex
+	std::vector<unsigned int> live(vertex_count);
+
+	for (size_t v = 0; v < vertex_count; v++)
+		live[v] = offsets[v + 1] - offsets[v];
+
+	std::vector<size_t> cached(vertex_count, 0);
+	std::vector<uint8_t> emitted(triangle_count, 0);
+	std::vector<unsigned int> dead_ends;
+	std::vector<unsigned int> candidates;
+	std::vector<unsigned int> result;
+	result.reserve(triangle_count * 3);
+
+	size_t time = cache_size + 1;
+	size_t cursor = 0;
+	long fanning = vertex_count ? 0 : -1;
+
+	while (fanning >= 0) {
+		candidates.clear();
+
+		for (unsigned int a = offsets[fanning]; a < offsets[fanning + 1]; a++) {
+			const unsigned int triangle = adjacency[a];
+
+			if (emitted[triangle])
+				continue;
+
+			for (int corner = 0; corner < 3; corner++) {
+				const unsigned int vertex = indices[triangle * 3 + corner];
+
+				result.push_back(vertex);
+				dead_ends.push_back(vertex);
+				candidates.push_back(vertex);
+				live[vertex]--;
+
+				if (time - cached[vertex] > cache_size)
+					cached[vertex] = time++;
+			}
+
+			emitted[triangle] = 1;
+		}
+
+		// the candidate furthest into the cache that will still be in it
+		// after its remaining triangles, 2 new vertices for each of them
+		fanning = -1;
+		size_t best = 0;
+
+		for (unsigned int vertex : candidates) {
+			if (!live[vertex])
+				continue;
+
+			size_t priority = 0;
+
+			if (time - cached[vertex] + 2 * live[vertex] <= cache_size)
+				priority = time - cached[vertex];
+
+			if (fanning < 0 || priority > best) {
+				best = priority;
+				fanning = vertex;
+			}
+		}
+
+		if (fanning >= 0)
+			continue;
+
+		// a dead end, back to recently used vertices, then to the next one in input order
+		while (!dead_ends.empty() && fanning < 0) {
+			const unsigned int vertex = dead_ends.back();
+			dead_ends.pop_back();
+
+			if (live[vertex])
+				fanning = vertex;
+		}
+
+		while (cursor < vertex_count && fanning < 0) {
+			if (live[cursor])
+				fanning = cursor;
+
+			cursor++;
+		}
+	}
+
+	memcpy(indices, result.data(), result.size() * sizeof(unsigned int));
+}
+
+// Renumbers vertices in the order the indices first use them, so the vertex
+// fetch walks memory forward. Vertices no index uses go last. vertex_size is
+// in floats, returns the new index of each old vertex.
+inline std::vector<unsigned int> optimize_vertex_fetch(unsigned int* indices, size_t index_count, float* vertices, size_t vertex_count, size_t vertex_size) {
+	const unsigned int UNUSED = ~0u;
+
+	std::vector<unsigned int> remap(vertex_count, UNUSED);
+	unsigned int next = 0;
+
+	for (size_t i = 0; i < index_count; i++) {
+		if (remap[indices[i]] == UNUSED)
+			remap[indices[i]] = next++;
+
+		indices[i] = remap[indices[i]];
+	}
+
+	for (size_t v = 0; v < vertex_count; v++) {
+		if (remap[v] == UNUSED)
+			remap[v] = next++;
+	}
+
+	std::vector<float> reordered(vertex_count * vertex_size);
+
+	for (size_t v = 0; v < vertex_count; v++)
+		memcpy(&reordered[remap[v] * vertex_size], &vertices[v * vertex_size], vertex_size * sizeof(float));
+
+	memcpy(vertices, reordered.data(), reordered.size() * sizeof(float));
+
+	return remap;
+}
+
+// Triangles of strips separated by restart, as a list in the same order and
+// winding, offset by base_vertex, so a strip can be analyzed like a list.
+// Degenerate triangles are left out.
+template<typename Index>
+inline void unstrip(const Index* strip, size_t count, Index restart, unsigned int base_vertex, std::vector<unsigned int>& triangles) {
+	size_t start = 0;
+
+	for (size_t i = 0; i < count; i++) {
+		if (strip[i] == restart) {
+			start = i + 1;
+			continue;
+		}
+
+		if (i < start + 2)
+			continue;
+
+		const unsigned int a = strip[i - 2], b = strip[i - 1], c = strip[i];
+
+		if (a == b || b == c || a == c)
+			continue;
+
+		// every other triangle of a strip is flipped to keep the winding
+		const bool odd = (i - start) % 2 == 1;
+
+		triangles.push_back(base_vertex + (odd ? b : a));
+		triangles.push_back(base_vertex + (odd ? a : b));
+		triangles.push_back(base_vertex + c);
+	}
+}
+
+struct OverdrawStats {
+	size_t covered;
+	size_t shaded;
+	double overdraw;
+};
+
+// Pixels shaded per pixel covered with a depth test, in index order, seen
+// along each axis from both sides. The mesh is fit into a resolution pixel
+// square and rasterized on the CPU with the same fill rules as the GPU, so
+// shared edges are drawn once. positions are 3 floats, stride floats apart.
+inline OverdrawStats analyze_overdraw(const unsigned int* indices, size_t index_count, const float* positions, size_t vertex_count, size_t stride, int resolution = 256) {
+	float low[3] = {INFINITY, INFINITY, INFINITY};
+	float high[3] = {-INFINITY, -INFINITY, -INFINITY};
+
+	for (size_t v = 0; v < vertex_count; v++) {
+		for (int axis = 0; axis < 3; axis++) {
+			low[axis] = std::min(low[axis], positions[v * stride + axis]);
+			high[axis] = std::max(high[axis], positions[v * stride + axis]);
+		}
+	}
+
+	// the same scale on every axis, the shape is kept
+	float extent = 0.0f;
+
+	for (int axis = 0; axis < 3; axis++)
+		extent = std::max(extent, high[axis] - low[axis]);
+
+	OverdrawStats stats = {0, 0, 0.0};
+
+	if (extent <= 0.0f)
+		return stats;
+
+	// 1/16 pixel fixed point, exact edge functions
+	const int SUBPIXEL = 16;
+	const float scale = (resolution - 1) * SUBPIXEL / extent;
+
+	std::vector<float> depth(resolution * resolution);
+	std::vector<uint32_t> hits(resolution * resolution);
+
+	for (int view = 0; view < 6; view++) {
+		const int axis = view / 2;
+		const int u = (axis + 1) % 3;
+		const int w = (axis + 2) % 3;
+		const float facing = view % 2 ? -1.0f : 1.0f;
+
+		std::fill(depth.begin(), depth.end(), INFINITY);
+		std::fill(hits.begin(), hits.end(), 0);
+
+		for (size_t i = 0; i + 2 < index_count; i += 3) {
+			int64_t x[3], y[3];
+			float z[3];
+
+			for (int corner = 0; corner < 3; corner++) {
+				const float* p = &positions[indices[i + corner] * stride];
+				x[corner] = std::lround((p[u] - low[u]) * scale);
+				y[corner] = std::lround((p[w] - low[w]) * scale);
+				z[corner] = facing * (p[axis] - low[axis]);
+			}
+
+			int64_t area = (x[1] - x[0]) * (y[2] - y[0]) - (y[1] - y[0]) * (x[2] - x[0]);
+
+			if (area == 0)
+				continue;
+
+			// counter clockwise from here on
+			if (area < 0) {
+				std::swap(x[1], x[2]);
+				std::swap(y[1], y[2]);
+				std::swap(z[1], z[2]);
+				area = -area;
+			}
+
+			const int64_t min_x = std::max<int64_t>(0, (std::min({x[0], x[1], x[2]}) - SUBPIXEL / 2) / SUBPIXEL);
+			const int64_t max_x = std::min<int64_t>(resolution - 1, (std::max({x[0], x[1], x[2]}) + SUBPIXEL / 2) / SUBPIXEL);
+			const int64_t min_y = std::max<int64_t>(0, (std::min({y[0], y[1], y[2]}) - SUBPIXEL / 2) / SUBPIXEL);
+			const int64_t max_y = std::min<int64_t>(resolution - 1, (std::max({y[0], y[1], y[2]}) + SUBPIXEL / 2) / SUBPIXEL);
+
+			// a pixel centre exactly on an edge goes to the triangle on its top or left side
+			int64_t bias[3];
+
+			for (int edge = 0; edge < 3; edge++) {
+				const int from = (edge + 1) % 3, to = (edge + 2) % 3;
+				const int64_t dx = x[to] - x[from], dy = y[to] - y[from];
+				const bool top_left = (dy == 0 && dx < 0) || dy > 0;
+				bias[edge] = top_left ? 0 : -1;
+			}
+
+			for (int64_t py = min_y; py <= max_y; py++) {
+				for (int64_t px = min_x; px <= max_x; px++) {
+					const int64_t cx = px * SUBPIXEL + SUBPIXEL / 2;
+					const int64_t cy = py * SUBPIXEL + SUBPIXEL / 2;
+
+					int64_t weight[3];
+					bool inside = true;
+
+					for (int edge = 0; edge < 3 && inside; edge++) {
+						const int from = (edge + 1) % 3, to = (edge + 2) % 3;
+						weight[edge] = (x[to] - x[from]) * (cy - y[from]) - (y[to] - y[from]) * (cx - x[from]);
+						inside = weight[edge] + bias[edge] >= 0;
+					}
+
+					if (!inside)
+						continue;
+
+					const float z_pixel = (weight[0] * z[0] + weight[1] * z[1] + weight[2] * z[2]) / (float)area;
+					const size_t pixel = py * resolution + px;
+
+					if (z_pixel < depth[pixel]) {
+						depth[pixel] = z_pixel;
+						hits[pixel]++;
+					}
+				}
+			}
+		}
+
+		for (uint32_t count : hits) {
+			stats.covered += count > 0;
+			stats.shaded += count;
+		}
+	}
+
+	stats.overdraw = stats.covered ? (double)stats.shaded / stats.covered : 0.0;
+
+	return stats;
+}
@@ -0,0 +1,155 @@
+#include <stdio.h>
+#include <string.h>
+
+#include <chrono>
+#include <cmath>
+#include <vector>
+
+#include "mesh_optimize.hpp"
+#include "grid.hpp"
+#include "plane.hpp"
+#include "vertex_format.hpp"
+
+// Vertex cache and overdraw numbers of an index buffer:
+//
+//   ./mesh_stats                                  the plane in rows, after Tipsify, as built and as strips,
+//                                                 and what its positions take in each vertex format
+//   ./mesh_stats <indices> [<positions>]          raw files, uint32 triangle list and 3 floats per vertex
+//
+// ACMR and ATVR are for a VERTEX_CACHE_SIZE entry FIFO, overdraw needs positions.
+
+static std::vector<uint8_t> read_file(const char* path) {
+	std::vector<uint8_t> contents;
+	FILE* file = fopen(path, "rb");
+
+	if (!file)
+		return contents;
+
+	fseek(file, 0, SEEK_END);
+	contents.resize(ftell(file));
+	fseek(file, 0, SEEK_SET);
+
+	if (fread(contents.data(), 1, contents.size(), file) != contents.size())
+		contents.clear();
+
+	fclose(file);
+
+	return contents;
+}
+
+static void report(const char* name, const unsigned int* indices, size_t index_count, const float* positions, size_t vertex_count, size_t stride) {
+	VertexCacheStats cache = analyze_vertex_cache(indices, index_count, vertex_count);
+
+	printf("%-12s %9zu triangles %9zu vertices  ACMR %.3f  ATVR %.3f", name, index_count / 3, vertex_count, cache.acmr, cache.atvr);
+
+	if (positions) {
+		OverdrawStats overdraw = analyze_overdraw(indices, index_count, positions, vertex_count, stride);
+		printf("  overdraw %.3f", overdraw.overdraw);
+	}
+
+	printf("\n");
+}
+
+// Positions of the plane's vertices, cell gives the row and column of each
+template<typename Cell>
+static std::vector<float> plane_positions(size_t vertex_count, Cell cell) {
+	std::vector<float> positions;
+	positions.reserve(3 * vertex_count);
+
+	for (size_t v = 0; v < vertex_count; v++) {
+		auto [x, z] = cell(v);
+		positions.push_back(x * SPACING);
+		positions.push_back(0.0f);
+		positions.push_back(z * SPACING);
+	}
+
+	return positions;
+}
+
+int main(int argc, char** argv) {
+	if (argc == 1) {
+		GridBuilder grid(SIZE);
+		const size_t vertex_count = grid.vertex_count();
+
+		std::vector<uint16_t> cells(2 * vertex_count);
+		std::vector<unsigned int> indices(grid.index_count());
+
+		// plain rows of cells first, the way the plane used to be indexed
+		for (int x = 0, i = 0; x < SIZE; x++) {
+			for (int z = 0; z < SIZE; z++) {
+				const unsigned int zero = x * (SIZE + 1) + z;
+				const unsigned int two = zero + SIZE + 1;
+				const unsigned int list[6] = {zero, zero + 1, two + 1, zero, two + 1, two};
+
+				for (unsigned int index : list)
+					indices[i++] = index;
+			}
+		}
+
+		std::vector<float> rows = plane_positions(vertex_count, [](size_t v) { return std::make_pair<int, int>(v / (SIZE + 1), v % (SIZE + 1)); });
+		report("row order", indices.data(), indices.size(), rows.data(), vertex_count, 3);
+
+		auto start = std::chrono::steady_clock::now();
+		optimize_vertex_cache(indices.data(), indices.size(), vertex_count);
+		auto end = std::chrono::steady_clock::now();
+
+		report("tipsify", indices.data(), indices.size(), rows.data(), vertex_count, 3);
+		printf("tipsify took %.1f ms\n", std::chrono::duration<double, std::milli>(end - start).count());
+
+		// what the plane is drawn with
+		grid.write(cells.data(), indices.data());
+		std::vector<float> blocks = plane_positions(vertex_count, [&](size_t v) { return std::make_pair<int, int>(cells[2 * v], cells[2 * v + 1]); });
+		report("grid", indices.data(), indices.size(), blocks.data(), vertex_count, 3);
+
+		// what a position costs in each format, halves lose precision far from the origin
+		std::vector<uint16_t> steps = quantize_grid(rows.data(), vertex_count, 3, SPACING, {0, 2});
+		float half_error = 0.0f;
+
+		for (float position : rows)
+			half_error = std::max(half_error, std::abs(from_half(to_half(position)) - position));
+
+		printf("position bytes: %zu as floats, %zu as halves (error up to %g), %zu as grid steps\n",
+			3 * sizeof(float), 3 * sizeof(Half), half_error, steps.size() / vertex_count * sizeof(uint16_t));
+
+		// the strips index the plane row by row
+		PlaneStrips strips = generate_plane_strips();
+		std::vector<unsigned int> triangles;
+
+		for (const Mesh::Chunk& chunk : strips.chunks)
+			unstrip<uint16_t>(&strips.indices[chunk.first], chunk.count, 0xffff, chunk.base_vertex, triangles);
+
+		report("strips", triangles.data(), triangles.size(), rows.data(), vertex_count, 3);
+		printf("index bytes: %zu as a list, %zu as strips\n", indices.size() * sizeof(unsigned int), strips.indices.size() * sizeof(uint16_t));
+
+		return 0;
+	}
+
+	std::vector<uint8_t> indices = read_file(argv[1]);
+	std::vector<uint8_t> positions = argc > 2 ? read_file(argv[2]) : std::vector<uint8_t>();
+
+	if (indices.empty() || indices.size() % (3 * sizeof(unsigned int))) {
+		fprintf(stderr, "%s is not a list of uint32 triangles\n", argv[1]);
+		return 1;
+	}
+
+	const unsigned int* index_data = (const unsigned int*)indices.data();
+	const size_t index_count = indices.size() / sizeof(unsigned int);
+
+	size_t vertex_count = positions.size() / (3 * sizeof(float));
+
+	for (size_t i = 0; i < index_count; i++)
+		vertex_count = std::max<size_t>(vertex_count, index_data[i] + 1);
+
+	if (!positions.empty() && positions.size() < vertex_count * 3 * sizeof(float)) {
+		fprintf(stderr, "%s has fewer vertices than the indices use\n", argv[2]);
+		return 1;
+	}
+
+	report(argv[1], index_data, index_count, positions.empty() ? nullptr : (const float*)positions.data(), vertex_count, 3);
+
+	std::vector<unsigned int> optimized(index_data, index_data + index_count);
+	optimize_vertex_cache(optimized.data(), index_count, vertex_count);
+	report("optimized", optimized.data(), index_count, positions.empty() ? nullptr : (const float*)positions.data(), vertex_count, 3);
+
+	return 0;
+}
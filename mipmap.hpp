@@ -0,0 +1,50 @@
+#pragma once
+
+#include <algorithm>
+#include <cstdint>
+#include <vector>
+
+// One level of an RGBA8 mip chain, rows bottom to top like OpenGL wants them
+struct MipLevel {
+	int width, height;
+	std::vector<uint8_t> pixels;
+};
+
+// Half the size with a 2x2 box filter, odd edges reuse their last texel
+inline MipLevel downsample(const MipLevel& source) {
+	MipLevel level = {std::max(1, source.width / 2), std::max(1, source.height / 2), {}};
+	level.pixels.resize((size_t)level.width * level.height * 4);
+
+	for (int y = 0; y < level.height; y++) {
+		const int y0 = std::min(2 * y, source.height - 1);
+		const int y1 = std::min(2 * y + 1, source.height - 1);
+
+		for (int x = 0; x < level.width; x++) {
+			const int x0 = std::min(2 * x, source.width - 1);
+			const int x1 = std::min(2 * x + 1, source.width - 1);
+
+			const uint8_t* a = &source.pixels[((size_t)y0 * source.width + x0) * 4];
+			const uint8_t* b = &source.pixels[((size_t)y0 * source.width + x1) * 4];
+			const uint8_t* c = &source.pixels[((size_t)y1 * source.width + x0) * 4];
+			const uint8_t* d = &source.pixels[((size_t)y1 * source.width + x1) * 4];
+
+			uint8_t* out = &level.pixels[((size_t)y * level.width + x) * 4];
+
+			for (int channel = 0; channel < 4; channel++)
+				out[channel] = (a[channel] + b[channel] + c[channel] + d[channel] + 2) / 4;
+		}
+	}
+
+	return level;
+}
+
+// Every level down to 1x1, the first one is the image itself
+inline std::vector<MipLevel> mip_chain(int width, int height, const uint8_t* pixels) {
+	std::vector<MipLevel> levels;
+	levels.push_back({width, height, std::vector<uint8_t>(pixels, pixels + (size_t)width * height * 4)});
+
+	while (levels.back().width > 1 || levels.back().height > 1)
+		levels.push_back(downsample(levels.back()));
+
+	return levels;
+}
@@ -0,0 +1,248 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <random>
+#include <vector>
+
+#include "fft.hpp"
+#include "job_system.hpp"
+
+#include "vendor/glm/glm.hpp"
+
+enum class Spectrum {
+	PHILLIPS,
+	JONSWAP,
+};
+
+struct OceanConfig {
+	// samples per side, power of two
+	int size = 256;
+	// side of the tileable patch, in plane units (meters)
+	float length = 10.0f;
+	Spectrum spectrum = Spectrum::JONSWAP;
+	// wind speed in m/s and the direction it blows to
+	float wind_speed = 4.0f;
+	glm::vec2 wind_direction = glm::vec2(1.0f, 1.0f);
+	// distance over which the wind has been blowing, for JONSWAP
+	float fetch = 1000.0f;
+	// Phillips constant
+	float phillips_amplitude = 2e-4f;
+	// horizontal displacement, 0 gives plain heights and 1 sharp crests
+	float choppiness = 0.8f;
+	unsigned int seed = 1;
+};
+
+// Tessendorf's FFT ocean. The spectrum is drawn once, every update evolves it
+// to the given time and runs three inverse FFTs, each carrying two real fields:
+// height and x displacement, z displacement and x slope, z slope alone.
+//
+// The results are tileable size x size maps, displacement as (x, y, z, 0) and
+// normals as (x, y, z, 0), ready to upload as RGBA float textures.
+struct Ocean {
+
+	static constexpr float GRAVITY = 9.81f;
+
+	Ocean(const OceanConfig& config, JobSystem* jobs) : config(config), jobs(jobs), fft(config.size, jobs) {
+		const size_t n = config.size;
+
+		h0_re.resize(n * n);
+		h0_im.resize(n * n);
+		omega.resize(n * n);
+
+		for (auto* field : {&height_re, &height_im, &choppy_re, &choppy_im, &slope_re, &slope_im})
+			field->resize(n * n);
+
+		displacement.resize(4 * n * n);
+		normals.resize(4 * n * n);
+
+		spectrum();
+	}
+
+	void update(float time) {
+		const size_t n = config.size;
+
+		jobs->parallel_for(n, 8, [&](size_t begin, size_t end) {
+			for (size_t row = begin; row < end; row++)
+				evolve(row, time);
+		});
+
+		fft.inverse(height_re.data(), height_im.data());
+		fft.inverse(choppy_re.data(), choppy_im.data());
+		fft.inverse(slope_re.data(), slope_im.data());
+
+		jobs->parallel_for(n, 8, [&](size_t begin, size_t end) {
+			for (size_t row = begin; row < end; row++)
+				assemble(row);
+		});
+	}
+
+	// Largest displacement in the last update
+	float bound() {
+		float bound = 0.0f;
+
+		for (size_t i = 0; i < displacement.size(); i++)
+			bound = std::max(bound, std::fabs(displacement[i]));
+
+		return bound;
+	}
+
+	int size() {
+		return config.size;
+	}
+
+	float length() {
+		return config.length;
+	}
+
+	std::vector<float> displacement;
+	std::vector<float> normals;
+
+private:
+	// wave vector of sample (x, z), negative frequencies in the upper half
+	glm::vec2 wave_vector(size_t x, size_t z) {
+		const int n = config.size;
+		int kx = x < (size_t)n / 2 ? (int)x : (int)x - n;
+		int kz = z < (size_t)n / 2 ? (int)z : (int)z - n;
+
+		return glm::vec2(kx, kz) * (2.0f * (float)M_PI / config.length);
+	}
+
+	// Variance density of the waves with wave vector k, per unit of k squared
+	float density(glm::vec2 k) {
+		const float length = glm::length(k);
+
+		if (length < 1e-6f)
+			return 0.0f;
+
+		const glm::vec2 wind = glm::normalize(config.wind_direction);
+		const float alignment = glm::dot(k / length, wind);
+
+		// damp the waves not much longer than a sample, they only alias
+		const float small = config.length / config.size;
+		const float damping = std::exp(-length * length * small * small);
+
+		if (config.spectrum == Spectrum::PHILLIPS) {
+			const float largest = config.wind_speed * config.wind_speed / GRAVITY;
+			const float k2 = length * length;
+
+			return config.phillips_amplitude * std::exp(-1.0f / (k2 * largest * largest)) / (k2 * k2)
+				* alignment * alignment * damping;
+		}
+
+		// JONSWAP in frequency, moved to wave vectors with deep water dispersion
+		// and spread with a cos^2 law around the wind
+		if (alignment <= 0.0f)
+			return 0.0f;
+
+		const float u = config.wind_speed;
+		const float f = config.fetch;
+		const float w = std::sqrt(GRAVITY * length);
+		const float peak = 22.0f * std::cbrt(GRAVITY * GRAVITY / (u * f));
+		const float alpha = 0.076f * std::pow(u * u / (f * GRAVITY), 0.22f);
+		const float sigma = w <= peak ? 0.07f : 0.09f;
+		const float r = std::exp(-(w - peak) * (w - peak) / (2.0f * sigma * sigma * peak * peak));
+		const float frequency = alpha * GRAVITY * GRAVITY / std::pow(w, 5.0f)
+			* std::exp(-1.25f * std::pow(peak / w, 4.0f)) * std::pow(3.3f, r);
+
+		const float dw_dk = GRAVITY / (2.0f * w);
+		const float spreading = 2.0f / (float)M_PI * alignment * alignment;
+
+		return frequency * dw_dk / length * spreading * damping;
+	}
+
+	void spectrum() {
+		const size_t n = config.size;
+		const float dk = 2.0f * (float)M_PI / config.length;
+
+		std::mt19937 random(config.seed);
+		std::normal_distribution<float> gaussian;
+
+		for (size_t z = 0; z < n; z++) {
+			for (size_t x = 0; x < n; x++) {
+				const size_t i = z * n + x;
+				const glm::vec2 k = wave_vector(x, z);
+
+				// amplitude of a sample that stands for a dk x dk cell of the spectrum
+				const float amplitude = std::sqrt(density(k) * dk * dk * 0.5f);
+
+				h0_re[i] = gaussian(random) * amplitude;
+				h0_im[i] = gaussian(random) * amplitude;
+				omega[i] = std::sqrt(GRAVITY * glm::length(k));
+			}
+		}
+	}
+
+	// h(k, t) = h0(k) e^(i w t) + conj(h0(-k)) e^(-i w t), and its derivatives
+	void evolve(size_t z, float time) {
+		const size_t n = config.size;
+		const size_t mz = (n - z) % n;
+
+		for (size_t x = 0; x < n; x++) {
+			const size_t i = z * n + x;
+			const size_t mirror = mz * n + (n - x) % n;
+
+			const float c = std::cos(omega[i] * time);
+			const float s = std::sin(omega[i] * time);
+
+			const float hr = (h0_re[i] + h0_re[mirror]) * c - (h0_im[i] + h0_im[mirror]) * s;
+			const float hi = (h0_im[i] - h0_im[mirror]) * c + (h0_re[i] - h0_re[mirror]) * s;
+
+			const glm::vec2 k = wave_vector(x, z);
+			const float length = glm::length(k);
+			const glm::vec2 unit = length > 0.0f ? k / length : glm::vec2(0.0f);
+
+			// displacement is -i k/|k| h and slope is i k h, real fields pack as re + i im
+			const float dx_re = unit.x * hi, dx_im = -unit.x * hr;
+			const float dz_re = unit.y * hi, dz_im = -unit.y * hr;
+			const float sx_re = -k.x * hi, sx_im = k.x * hr;
+			const float sz_re = -k.y * hi, sz_im = k.y * hr;
+
+			height_re[i] = hr - dx_im;
+			height_im[i] = hi + dx_re;
+
+			choppy_re[i] = dz_re - sx_im;
+			choppy_im[i] = dz_im + sx_re;
+
+			slope_re[i] = sz_re;
+			slope_im[i] = sz_im;
+		}
+	}
+
+	void assemble(size_t z) {
+		const size_t n = config.size;
+		const float choppiness = config.choppiness;
+
+		for (size_t x = 0; x < n; x++) {
+			const size_t i = z * n + x;
+
+			// horizontal displacement goes against D to pull points towards the crests
+			float* d = &displacement[4 * i];
+			d[0] = -choppiness * height_im[i];
+			d[1] = height_re[i];
+			d[2] = -choppiness * choppy_re[i];
+			d[3] = 0.0f;
+
+			glm::vec3 normal = glm::normalize(glm::vec3(-choppy_im[i], 1.0f, -slope_re[i]));
+
+			float* m = &normals[4 * i];
+			m[0] = normal.x;
+			m[1] = normal.y;
+			m[2] = normal.z;
+			m[3] = 0.0f;
+		}
+	}
+
+	OceanConfig config;
+	JobSystem* jobs;
+	FFT2D fft;
+
+	std::vector<float> h0_re, h0_im;
+	std::vector<float> omega;
+
+	// inverse FFT inputs and outputs, two real fields each
+	std::vector<float> height_re, height_im;
+	std::vector<float> choppy_re, choppy_im;
+	std::vector<float> slope_re, slope_im;
+};
@@ -0,0 +1,132 @@
+#pragma once
+
+#include <algorithm>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "grid.hpp"
+#include "mesh.hpp"
+#include "job_system.hpp"
+
+// The plane the water is drawn on: SIZE x SIZE cells SPACING apart, from the
+// origin along +x and +z.
+const int SIZE = 1000;
+const float SPACING = 0.01f;
+
+const int VERTEX_SIZE = 3;
+
+// The plane into mesh as a triangle list, built on jobs, for plane.vert with
+// QUANTIZED and spacing set to SPACING, false when it could not be written
+bool upload_plane(Mesh* mesh, JobSystem* jobs) {
+	return GridBuilder(SIZE, jobs).build(mesh);
+}
+
+// Cells per strip, the row of vertices a strip shares with the one after it
+// is still in a 16 entry vertex cache when that one gets to it
+const int STRIP_CELLS = 6;
+
+// Vertex rows per chunk, as many as 16 bit indices reach with 0xffff kept for restarts
+const int CHUNK_ROWS = 0xffff / (SIZE + 1);
+
+static_assert(CHUNK_ROWS >= 2, "A row of the plane does not fit 16 bit indices");
+
+// The plane as triangle strips, 2 indices and a bit per cell instead of 6
+struct PlaneStrips {
+	std::vector<uint16_t> cells;
+	std::vector<uint16_t> indices;
+	std::vector<Mesh::Chunk> chunks;
+};
+
+// Bands of CHUNK_ROWS vertex rows along x, each indexed from its first row
+// with a base vertex. Inside a band, columns of STRIP_CELLS cells are walked
+// one strip per row of cells, ending in a restart. Strips wind the same way as
+// the triangles of GridBuilder. Vertices are whole cells, row by row.
+PlaneStrips generate_plane_strips() {
+	PlaneStrips strips;
+	strips.cells.reserve(2 * (SIZE + 1) * (SIZE + 1));
+
+	for (int x = 0; x < SIZE + 1; x++) {
+		for (int z = 0; z < SIZE + 1; z++) {
+			strips.cells.push_back(x);
+			strips.cells.push_back(z);
+		}
+	}
+
+	for (int first_row = 0; first_row < SIZE; first_row += CHUNK_ROWS - 1) {
+		const int last_row = std::min(SIZE, first_row + CHUNK_ROWS - 1);
+		Mesh::Chunk chunk = {0, strips.indices.size(), first_row * (SIZE + 1)};
+
+		for (int first_column = 0; first_column < SIZE; first_column += STRIP_CELLS) {
+			const int last_column = std::min(SIZE, first_column + STRIP_CELLS);
+
+			for (int x = first_row; x < last_row; x++) {
+				/**
+				 * 1   3   5
+				 * . - . - .
+				 * | / | / |
+				 * . - . - .
+				 * 0   2   4
+				 */
+				for (int z = first_column; z <= last_column; z++) {
+					strips.indices.push_back((x + 1 - first_row) * (SIZE + 1) + z);
+					strips.indices.push_back((x - first_row) * (SIZE + 1) + z);
+				}
+
+				strips.indices.push_back(0xffff);
+			}
+		}
+
+		chunk.count = strips.indices.size() - chunk.first;
+		strips.chunks.push_back(chunk);
+	}
+
+	return strips;
+}
+
+// The plane as strips into mesh, for plane.vert with QUANTIZED and spacing set to SPACING
+void upload_plane_strips(Mesh* mesh) {
+	PlaneStrips strips = generate_plane_strips();
+
+	mesh->data(strips.cells.size() * sizeof(uint16_t), strips.cells.data(), GL_STATIC_DRAW);
+	mesh->integer_attributes<uint16_t>(2, 2 * sizeof(uint16_t));
+	mesh->indices(strips.indices.size() * sizeof(uint16_t), strips.indices.data(), GL_STATIC_DRAW);
+	mesh->primitive_restart(true);
+	mesh->chunks(strips.chunks);
+	mesh->mode(GL_TRIANGLE_STRIP);
+}
+
+// Coarse grid of quads with the same extent as the plane, for the tessellation stages
+void generate_patches(Mesh* mesh, int patches) {
+	std::vector<float> vertices;
+	std::vector<unsigned int> indices;
+
+	const float spacing = SIZE * SPACING / patches;
+
+	for (int x = 0; x < patches + 1; x++) {
+		for (int z = 0; z < patches + 1; z++) {
+			vertices.push_back(x * spacing);
+			vertices.push_back(0.0f);
+			vertices.push_back(z * spacing);
+		}
+	}
+
+	for (int x = 0; x < patches; x++) {
+		for (int z = 0; z < patches; z++) {
+			auto zero = x * (patches + 1) + z;
+
+			// (0, 0), (1, 0), (1, 1), (0, 1) in the quad domain, u along x
+			indices.push_back(zero);
+			indices.push_back(zero + patches + 1);
+			indices.push_back(zero + patches + 2);
+			indices.push_back(zero + 1);
+		}
+	}
+
+	mesh->data(vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+	mesh->attributes<float>(3, false, VERTEX_SIZE * sizeof(float));
+	mesh->indices(indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+	mesh->mode(GL_PATCHES);
+	mesh->patch_vertices(4);
+}
@@ -1,6 +1,32 @@
 #version 400
 
-in vec4 vposition;
+#if defined(ATTRIBUTELESS) || defined(QUANTIZED)
+uniform float spacing;
+#endif
+
+#ifdef ATTRIBUTELESS
+
+// corners of the two triangles of a cell, same order as the index buffer in water.cpp
+const ivec2 corners[6] = ivec2[6](
+	ivec2(0, 0), ivec2(0, 1), ivec2(1, 1),
+	ivec2(0, 0), ivec2(1, 1), ivec2(1, 0)
+);
+#elif defined(QUANTIZED)
+// whole cells from the origin, y is always 0
+layout(location = 0) in uvec2 vcell;
+#elif defined(TILED)
+// position inside the tile and the tile offset, one per instance
+layout(location = 0) in vec4 vlocal;
+layout(location = 1) in vec2 toffset;
+#else
+layout(location = 0) in vec4 vposition;
+#endif
+
+#ifdef CLIPMAP
+// in cells of the current level
+uniform ivec2 origin;
+uniform ivec4 bounds;
+#endif
 
 uniform float time;
 
@@ -8,30 +34,55 @@ uniform mat4 mvp;
 
 out vec3 normal;
 
+#include "waves.glsl"
+
 void main() {
 
-	// sum of sines
-	float dy = 0.0;
+#ifdef TESSELLATED
+	// the patch corners go through untouched, plane.tese adds the waves
+	gl_Position = vposition;
+#else
 
-	float amplitude = 0.1;
-	float frequency = 10.0;
-	float speed = 1.0;
+#ifdef ATTRIBUTELESS
+	// one instance per row of cells along x, six vertices per cell along z
+	ivec2 cell = ivec2(gl_InstanceID, gl_VertexID / 6) + corners[gl_VertexID % 6];
+#ifdef CLIPMAP
+	cell += origin;
+#endif
+	vec4 vposition = vec4(float(cell.x) * spacing, 0.0, float(cell.y) * spacing, 1.0);
+#endif
 
-	float partialD = 0.0;
+#ifdef QUANTIZED
+	vec4 vposition = vec4(float(vcell.x) * spacing, 0.0, float(vcell.y) * spacing, 1.0);
+#endif
 
-	for (int i = 0; i < 2; i++) {
-		dy += amplitude * sin(frequency * (vposition.x + vposition.z) + speed * time);
+#ifdef TILED
+	vec4 vposition = vlocal + vec4(toffset.x, 0.0, toffset.y, 0.0);
+#endif
 
-		partialD += amplitude * frequency * cos(frequency * (vposition.x + vposition.z) + speed * time);
+	vec3 surfaceNormal;
+	vec3 displacement = surface(vposition.xz, surfaceNormal);
 
-		amplitude *= 0.82;
-		frequency *= 1.18;
-	}
+#ifdef CLIPMAP
+	// the coarser level around this one does not have the odd vertices of the
+	// outer edge, put them on the line between their neighbours to avoid cracks
+	ivec2 edge = ivec2(0);
+
+	if ((cell.x == bounds.x || cell.x == bounds.z) && (cell.y & 1) != 0)
+		edge = ivec2(0, 1);
 
-	gl_Position = mvp * vec4(vposition.x, vposition.y + dy, vposition.z, 1.0);
+	if ((cell.y == bounds.y || cell.y == bounds.w) && (cell.x & 1) != 0)
+		edge = ivec2(1, 0);
+
+	if (edge != ivec2(0)) {
+		vec3 previousNormal, nextNormal;
+		displacement = 0.5 * (surface(vec2(cell - edge) * spacing, previousNormal) + surface(vec2(cell + edge) * spacing, nextNormal));
+		surfaceNormal = normalize(previousNormal + nextNormal);
+	}
+#endif
 
-	vec3 partialDerivativeX = vec3(1.0, partialD, 0.0);
-	vec3 partialDerivativeZ = vec3(0.0, partialD, 1.0);
+	gl_Position = mvp * vec4(vposition.xyz + displacement, 1.0);
 
-	normal = normalize(cross(partialDerivativeZ, partialDerivativeX));
-}
\ No newline at end of file
+	normal = surfaceNormal;
+#endif
+}
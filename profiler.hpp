@@ -0,0 +1,335 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <cfloat>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <map>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "log.hpp"
+#include "ring.hpp"
+
+#include "vendor/imgui/imgui.h"
+
+// CPU and GPU timings per frame, kept as a short history per scope for the
+// overlay and, when tracing, as a full list of events for a Chrome trace.
+//
+// CPU scopes can close on any thread, they go through a lock-free ring that
+// end_frame() drains. GPU scopes are pairs of timestamp queries; a frame's
+// queries are only read back when their set comes round again, FRAMES later,
+// so the results are in by then and reading them does not stall.
+struct Profiler {
+
+	// frames of history kept per scope
+	static constexpr size_t HISTORY = 256;
+	// query sets in flight
+	static constexpr size_t FRAMES = 3;
+	// GPU scopes in one frame
+	static constexpr size_t GPU_SCOPES = 64;
+
+	struct Sample {
+		const char* name;
+		int64_t begin, end;
+		uint32_t thread;
+		bool gpu;
+	};
+
+	Profiler() : samples(1 << 14), epoch(std::chrono::steady_clock::now()) {
+		for (QuerySet& set : sets) {
+			set.queries.resize(2 * GPU_SCOPES);
+			set.names.resize(GPU_SCOPES);
+			GL_CALL(glGenQueries(set.queries.size(), set.queries.data()));
+		}
+
+		frame_begin = now();
+	}
+
+	~Profiler() {
+		for (QuerySet& set : sets) {
+			GL_CALL(glDeleteQueries(set.queries.size(), set.queries.data()));
+		}
+	}
+
+	// Nanoseconds since the profiler was made
+	int64_t now() {
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+	}
+
+	// Keeps every sample for dump() from now on
+	void trace(bool enable = true) {
+		tracing = enable;
+	}
+
+	void begin_frame() {
+		QuerySet& set = sets[frame_number % FRAMES];
+
+		resolve(set);
+
+		// GPU timestamps go on the CPU timeline through this pair
+		GL_CALL(glGetInteger64v(GL_TIMESTAMP, &set.gpu_base));
+		set.cpu_base = now();
+		set.used = 0;
+	}
+
+	void end_frame() {
+		int64_t end = now();
+		record({"frame", frame_begin, end, thread_index(), false});
+		frame_begin = end;
+
+		Sample sample;
+
+		while (samples.pop(sample))
+			record(sample);
+
+		frame_number++;
+	}
+
+	// Called on any thread
+	void cpu(const char* name, int64_t begin, int64_t end) {
+		samples.push({name, begin, end, thread_index(), false});
+	}
+
+	// Index of a GPU scope opened now, for gpu_end()
+	size_t gpu_begin(const char* name) {
+		QuerySet& set = sets[frame_number % FRAMES];
+
+		if (set.used == GPU_SCOPES)
+			return GPU_SCOPES;
+
+		size_t scope = set.used++;
+		set.names[scope] = name;
+		GL_CALL(glQueryCounter(set.queries[2 * scope], GL_TIMESTAMP));
+
+		return scope;
+	}
+
+	void gpu_end(size_t scope) {
+		if (scope == GPU_SCOPES)
+			return;
+
+		QuerySet& set = sets[frame_number % FRAMES];
+		GL_CALL(glQueryCounter(set.queries[2 * scope + 1], GL_TIMESTAMP));
+	}
+
+	// Per scope percentiles and the frame times, in an ImGui window
+	void overlay() {
+		ImGui::SetNextWindowPos(ImVec2(10.0f, 10.0f), ImGuiCond_FirstUseEver);
+		ImGui::Begin("Profiler", nullptr, ImGuiWindowFlags_AlwaysAutoResize);
+
+		auto frame = scopes.find("frame");
+
+		if (frame != scopes.end() && frame->second.count) {
+			History& history = frame->second;
+			const size_t count = std::min(history.count, HISTORY);
+
+			float average = 0.0f;
+			float slowest = 0.0f;
+
+			for (size_t i = 0; i < count; i++) {
+				average += history.values[i];
+				slowest = std::max(slowest, history.values[i]);
+			}
+
+			average /= count;
+			slowest = std::max(slowest, 1e-3f);
+
+			ImGui::Text("%.1f fps, %.2f ms", 1000.0f / average, average);
+			// oldest first once the history has wrapped
+			const int offset = history.count > HISTORY ? history.count % HISTORY : 0;
+			ImGui::PlotLines("frame ms", history.values, count, offset, nullptr, 0.0f, slowest, ImVec2(0.0f, 60.0f));
+
+			// how often each frame time comes up, 32 bins up to the slowest
+			float bins[32] = {};
+
+			for (size_t i = 0; i < count; i++)
+				bins[std::min<size_t>(31, (size_t)(history.values[i] / slowest * 32.0f))] += 1.0f;
+
+			char label[64];
+			snprintf(label, sizeof(label), "0 - %.1f ms", slowest);
+			ImGui::PlotHistogram("histogram", bins, 32, 0, label, 0.0f, FLT_MAX, ImVec2(0.0f, 60.0f));
+		}
+
+		if (ImGui::BeginTable("scopes", 6, ImGuiTableFlags_Borders | ImGuiTableFlags_RowBg)) {
+			ImGui::TableSetupColumn("scope");
+			ImGui::TableSetupColumn("on");
+			ImGui::TableSetupColumn("p50 ms");
+			ImGui::TableSetupColumn("p95 ms");
+			ImGui::TableSetupColumn("p99 ms");
+			ImGui::TableSetupColumn("max ms");
+			ImGui::TableHeadersRow();
+
+			std::vector<float> sorted;
+
+			for (auto& [name, history] : scopes) {
+				const size_t count = std::min(history.count, HISTORY);
+
+				if (!count)
+					continue;
+
+				sorted.assign(history.values, history.values + count);
+				std::sort(sorted.begin(), sorted.end());
+
+				auto percentile = [&](float p) {
+					return sorted[std::min(count - 1, (size_t)(p * count))];
+				};
+
+				ImGui::TableNextRow();
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted(name);
+				ImGui::TableNextColumn();
+				ImGui::TextUnformatted(history.gpu ? "gpu" : "cpu");
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f", percentile(0.50f));
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f", percentile(0.95f));
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f", percentile(0.99f));
+				ImGui::TableNextColumn();
+				ImGui::Text("%.3f", sorted.back());
+			}
+
+			ImGui::EndTable();
+		}
+
+		if (samples.lost())
+			ImGui::Text("%zu samples dropped", samples.lost());
+
+		ImGui::End();
+	}
+
+	// Everything recorded while tracing, in the Chrome trace event format
+	bool dump(const char* path) {
+		FILE* file = fopen(path, "w");
+
+		if (!file) {
+			gl_log_error("ERROR: could not open trace file %s\n", path);
+			return false;
+		}
+
+		fprintf(file, "{\"traceEvents\":[\n");
+
+		for (size_t i = 0; i < events.size(); i++) {
+			const Sample& event = events[i];
+
+			// GPU scopes get a track of their own
+			fprintf(file, "{\"name\":\"%s\",\"cat\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":0,\"tid\":%u}%s\n",
+				event.name, event.gpu ? "gpu" : "cpu", event.begin / 1000.0, (event.end - event.begin) / 1000.0,
+				event.gpu ? 1000u : event.thread, i + 1 < events.size() ? "," : "");
+		}
+
+		fprintf(file, "],\"displayTimeUnit\":\"ms\"}\n");
+		fclose(file);
+
+		return true;
+	}
+
+	size_t frames() {
+		return frame_number;
+	}
+
+private:
+	struct History {
+		bool gpu = false;
+		float values[HISTORY] = {};
+		size_t count = 0;
+	};
+
+	struct QuerySet {
+		std::vector<GLuint> queries;
+		std::vector<const char*> names;
+		size_t used = 0;
+		GLint64 gpu_base = 0;
+		int64_t cpu_base = 0;
+	};
+
+	struct Less {
+		bool operator()(const char* a, const char* b) const {
+			return strcmp(a, b) < 0;
+		}
+	};
+
+	void record(const Sample& sample) {
+		History& history = scopes[sample.name];
+		history.gpu = sample.gpu;
+		history.values[history.count++ % HISTORY] = (sample.end - sample.begin) / 1e6f;
+
+		if (tracing)
+			events.push_back(sample);
+	}
+
+	void resolve(QuerySet& set) {
+		for (size_t scope = 0; scope < set.used; scope++) {
+			GLint available = 0;
+			GL_CALL(glGetQueryObjectiv(set.queries[2 * scope + 1], GL_QUERY_RESULT_AVAILABLE, &available));
+
+			// only late when the GPU is more than FRAMES behind, skipped rather than waited for
+			if (!available)
+				continue;
+
+			GLuint64 begin, end;
+			GL_CALL(glGetQueryObjectui64v(set.queries[2 * scope], GL_QUERY_RESULT, &begin));
+			GL_CALL(glGetQueryObjectui64v(set.queries[2 * scope + 1], GL_QUERY_RESULT, &end));
+
+			int64_t offset = set.cpu_base - set.gpu_base;
+			record({set.names[scope], (int64_t)begin + offset, (int64_t)end + offset, 0, true});
+		}
+	}
+
+	static uint32_t thread_index() {
+		static std::atomic<uint32_t> threads{0};
+		thread_local uint32_t index = threads++;
+		return index;
+	}
+
+	MpscRing<Sample> samples;
+	std::chrono::steady_clock::time_point epoch;
+
+	QuerySet sets[FRAMES];
+	size_t frame_number = 0;
+	int64_t frame_begin = 0;
+
+	std::map<const char*, History, Less> scopes;
+
+	bool tracing = false;
+	std::vector<Sample> events;
+};
+
+// Times the enclosing block on the CPU
+struct ProfileScope {
+	ProfileScope(Profiler* profiler, const char* name) : profiler(profiler), name(name) {
+		if (profiler)
+			begin = profiler->now();
+	}
+
+	~ProfileScope() {
+		if (profiler)
+			profiler->cpu(name, begin, profiler->now());
+	}
+
+	Profiler* profiler;
+	const char* name;
+	int64_t begin = 0;
+};
+
+// Times the GPU commands issued in the enclosing block
+struct GpuScope {
+	GpuScope(Profiler* profiler, const char* name) : profiler(profiler) {
+		if (profiler)
+			scope = profiler->gpu_begin(name);
+	}
+
+	~GpuScope() {
+		if (profiler)
+			profiler->gpu_end(scope);
+	}
+
+	Profiler* profiler;
+	size_t scope = 0;
+};
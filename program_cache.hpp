@@ -0,0 +1,262 @@
+#pragma once
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "log.hpp"
+
+// Linked programs saved with glGetProgramBinary and loaded back with
+// glProgramBinary, one file per program named after its key. The key hashes
+// the expanded sources, the defines and the driver's vendor, renderer and
+// version strings, so any change to them misses instead of loading a stale
+// binary. Files go in a directory named after the format version and carry a
+// header with the key, the binary format, the length and a checksum, checked
+// before the binary goes anywhere near the driver. The driver can still
+// reject a binary, the caller compiles from source then and stores it anew.
+struct ProgramCache {
+
+	// bumped whenever the file layout changes, older directories are ignored
+	static constexpr uint32_t VERSION = 1;
+
+	// The directory is made if needed, root defaults to $XDG_CACHE_HOME/water or ~/.cache/water
+	ProgramCache(const char* root = nullptr) {
+		std::string base;
+
+		if (root) {
+			base = root;
+		} else if (const char* xdg = getenv("XDG_CACHE_HOME"); xdg && *xdg) {
+			base = std::string(xdg) + "/water";
+		} else if (const char* home = getenv("HOME"); home && *home) {
+			base = std::string(home) + "/.cache/water";
+		} else {
+			base = ".cache/water";
+		}
+
+		directory = base + "/programs/v" + std::to_string(VERSION);
+
+		GLint formats = 0;
+
+		if (GLEW_ARB_get_program_binary) {
+			GL_CALL(glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats));
+		}
+
+		if (formats > 0) {
+			binary_formats.resize(formats);
+			GL_CALL(glGetIntegerv(GL_PROGRAM_BINARY_FORMATS, (GLint*)binary_formats.data()));
+		}
+
+		usable = formats > 0 && make_directories(directory);
+
+		if (!usable) {
+			gl_log("program cache disabled, %d binary formats\n", formats);
+			return;
+		}
+
+		const GLenum names[] = {GL_VENDOR, GL_RENDERER, GL_VERSION, GL_SHADING_LANGUAGE_VERSION};
+
+		for (GLenum name : names) {
+			const GLubyte* value;
+			GL_CALL(value = glGetString(name));
+
+			if (value)
+				driver += (const char*)value;
+
+			driver += '\n';
+		}
+
+		gl_log("program cache in %s\n", directory.c_str());
+	}
+
+	bool enabled() {
+		return usable;
+	}
+
+	// Key of a program from its sources, in any number of pieces
+	uint64_t key(const std::vector<std::string>& pieces) {
+		uint64_t hash = fnv1a(FNV_OFFSET, driver.data(), driver.size());
+
+		// the length goes in too, so moving text between pieces changes the key
+		for (const std::string& piece : pieces) {
+			uint64_t length = piece.size();
+			hash = fnv1a(hash, &length, sizeof(length));
+			hash = fnv1a(hash, piece.data(), piece.size());
+		}
+
+		return hash;
+	}
+
+	// Loads the binary into program, false if there is none or it is not valid
+	bool load(uint64_t key, GLuint program) {
+		if (!usable)
+			return false;
+
+		FILE* file = fopen(path(key).c_str(), "rb");
+
+		if (!file) {
+			miss_count++;
+			return false;
+		}
+
+		Header header;
+		std::vector<uint8_t> binary;
+
+		bool valid = fread(&header, sizeof(header), 1, file) == 1
+			&& !memcmp(header.magic, MAGIC, sizeof(header.magic))
+			&& header.version == VERSION
+			&& header.key == key
+			&& header.length > 0
+			&& std::find(binary_formats.begin(), binary_formats.end(), header.format) != binary_formats.end();
+
+		if (valid) {
+			binary.resize(header.length);
+			// the length has to match the file exactly, a truncated write is caught here
+			valid = fread(binary.data(), 1, binary.size(), file) == binary.size() && fgetc(file) == EOF
+				&& fnv1a(FNV_OFFSET, binary.data(), binary.size()) == header.checksum;
+		}
+
+		fclose(file);
+
+		if (!valid) {
+			gl_log("program cache: %s is damaged, compiling from source\n", path(key).c_str());
+			remove(path(key).c_str());
+			miss_count++;
+			return false;
+		}
+
+		GL_CALL(glProgramBinary(program, header.format, binary.data(), binary.size()));
+
+		GLint linked = GL_FALSE;
+		GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &linked));
+
+		if (linked != GL_TRUE) {
+			gl_log("program cache: driver rejected %s, compiling from source\n", path(key).c_str());
+			remove(path(key).c_str());
+			miss_count++;
+			return false;
+		}
+
+		hit_count++;
+		return true;
+	}
+
+	// Saves a linked program, made with GL_PROGRAM_BINARY_RETRIEVABLE_HINT
+	void store(uint64_t key, GLuint program) {
+		if (!usable)
+			return;
+
+		GLint length = 0;
+		GL_CALL(glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length));
+
+		if (length <= 0)
+			return;
+
+		std::vector<uint8_t> binary(length);
+		Header header = {};
+		GLsizei written = 0;
+
+		GL_CALL(glGetProgramBinary(program, length, &written, &header.format, binary.data()));
+
+		if (written <= 0)
+			return;
+
+		binary.resize(written);
+
+		memcpy(header.magic, MAGIC, sizeof(header.magic));
+		header.version = VERSION;
+		header.key = key;
+		header.length = binary.size();
+		header.checksum = fnv1a(FNV_OFFSET, binary.data(), binary.size());
+
+		// written next to the final name and renamed, readers never see half a file
+		std::string final_path = path(key);
+		std::string temporary = final_path + ".tmp" + std::to_string(getpid());
+
+		FILE* file = fopen(temporary.c_str(), "wb");
+
+		if (!file) {
+			gl_log_error("ERROR: could not write program cache file %s\n", temporary.c_str());
+			return;
+		}
+
+		bool complete = fwrite(&header, sizeof(header), 1, file) == 1 && fwrite(binary.data(), 1, binary.size(), file) == binary.size();
+		complete = fclose(file) == 0 && complete;
+
+		if (!complete || rename(temporary.c_str(), final_path.c_str())) {
+			gl_log_error("ERROR: could not write program cache file %s\n", final_path.c_str());
+			remove(temporary.c_str());
+		}
+	}
+
+	size_t hits() {
+		return hit_count;
+	}
+
+	size_t misses() {
+		return miss_count;
+	}
+
+private:
+	static constexpr char MAGIC[4] = {'W', 'P', 'B', 'C'};
+	static constexpr uint64_t FNV_OFFSET = 14695981039346656037ull;
+
+	struct Header {
+		char magic[4];
+		uint32_t version;
+		uint64_t key;
+		GLenum format;
+		uint32_t length;
+		uint64_t checksum;
+	};
+
+	static uint64_t fnv1a(uint64_t hash, const void* data, size_t size) {
+		const uint8_t* bytes = (const uint8_t*)data;
+
+		for (size_t i = 0; i < size; i++) {
+			hash ^= bytes[i];
+			hash *= 1099511628211ull;
+		}
+
+		return hash;
+	}
+
+	std::string path(uint64_t key) {
+		char name[32];
+		snprintf(name, sizeof(name), "/%016llx.bin", (unsigned long long)key);
+		return directory + name;
+	}
+
+	// mkdir -p
+	static bool make_directories(const std::string& path) {
+		for (size_t slash = path.find('/', 1); ; slash = path.find('/', slash + 1)) {
+			std::string prefix = path.substr(0, slash);
+
+			if (mkdir(prefix.c_str(), 0755) && errno != EEXIST) {
+				gl_log_error("ERROR: could not make cache directory %s\n", prefix.c_str());
+				return false;
+			}
+
+			if (slash == std::string::npos)
+				return true;
+		}
+	}
+
+	std::string directory;
+	std::string driver;
+	std::vector<GLenum> binary_formats;
+	bool usable = false;
+
+	size_t hit_count = 0;
+	size_t miss_count = 0;
+};
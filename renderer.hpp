@@ -1,10 +1,17 @@
+#pragma once
+
 #include <cassert>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include <EGL/egl.h>
+#include <EGL/eglext.h>
+
 #include "mesh.hpp"
 #include "shader.hpp"
+#include "capture.hpp"
+#include "command_queue.hpp"
 
 struct Renderer {
 
@@ -19,6 +26,17 @@ struct Renderer {
 	}
 
 	~Renderer() {
+		if (headless) {
+			GL_CALL(glDeleteFramebuffers(1, &framebuffer));
+			GL_CALL(glDeleteRenderbuffers(1, &color));
+			GL_CALL(glDeleteRenderbuffers(1, &depth));
+
+			eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, EGL_NO_CONTEXT);
+			eglDestroyContext(display, context);
+			eglTerminate(display);
+			return;
+		}
+
 		if (window)
 			glfwDestroyWindow(window);
 
@@ -52,6 +70,8 @@ struct Renderer {
 
 		glfwWindowHint(GLFW_SAMPLES, 4);
 
+		glfwWindowHint(GLFW_OPENGL_DEBUG_CONTEXT, GL_CHECK == GL_CHECK_FULL);
+
 		GLFWmonitor* monitor = glfwGetPrimaryMonitor();
 		const GLFWvidmode* videomode = glfwGetVideoMode(monitor);
 
@@ -68,41 +88,192 @@ struct Renderer {
 
 		glewInit();
 
+		gl_debug_setup();
+
+		log_gl_params();
+
+		return true;
+	}
+
+	// No display at all: an EGL context with no surface, on Mesa's surfaceless
+	// platform when there is one, drawing into a framebuffer object. The loop
+	// ends after the given number of frames, or when closed if it is zero.
+	bool start_headless(size_t frames = 0) {
+		assert(restart_gl_log());
+
+		gl_log("starting headless EGL\n");
+
+		auto get_platform_display = (PFNEGLGETPLATFORMDISPLAYEXTPROC)eglGetProcAddress("eglGetPlatformDisplayEXT");
+
+		display = EGL_NO_DISPLAY;
+
+		if (get_platform_display)
+			display = get_platform_display(EGL_PLATFORM_SURFACELESS_MESA, EGL_DEFAULT_DISPLAY, NULL);
+
+		if (display == EGL_NO_DISPLAY)
+			display = eglGetDisplay(EGL_DEFAULT_DISPLAY);
+
+		EGLint major, minor;
+
+		if (display == EGL_NO_DISPLAY || !eglInitialize(display, &major, &minor)) {
+			gl_log_error("ERROR: could not initialize EGL, error 0x%x\n", eglGetError());
+			return false;
+		}
+
+		gl_log("EGL %i.%i %s\n", major, minor, eglQueryString(display, EGL_VENDOR));
+
+		if (!eglBindAPI(EGL_OPENGL_API)) {
+			gl_log_error("ERROR: EGL has no desktop OpenGL\n");
+			return false;
+		}
+
+		// same version and profile as the window
+		const EGLint attributes[] = {
+			EGL_CONTEXT_MAJOR_VERSION, 4,
+			EGL_CONTEXT_MINOR_VERSION, 0,
+			EGL_CONTEXT_OPENGL_PROFILE_MASK, EGL_CONTEXT_OPENGL_CORE_PROFILE_BIT,
+			EGL_CONTEXT_OPENGL_FORWARD_COMPATIBLE, EGL_TRUE,
+			EGL_CONTEXT_OPENGL_DEBUG, GL_CHECK == GL_CHECK_FULL,
+			EGL_NONE,
+		};
+
+		context = eglCreateContext(display, EGL_NO_CONFIG_KHR, EGL_NO_CONTEXT, attributes);
+
+		if (context == EGL_NO_CONTEXT || !eglMakeCurrent(display, EGL_NO_SURFACE, EGL_NO_SURFACE, context)) {
+			gl_log_error("ERROR: could not create a surfaceless context, error 0x%x\n", eglGetError());
+			eglTerminate(display);
+			return false;
+		}
+
+		headless = true;
+		frame_limit = frames;
+
+		// GLEW looks for a GLX display once the functions are loaded, there is none
+		glewExperimental = GL_TRUE;
+		GLenum error = glewInit();
+
+#ifdef GLEW_ERROR_NO_GLX_DISPLAY
+		if (error == GLEW_ERROR_NO_GLX_DISPLAY)
+			error = GLEW_OK;
+#endif
+
+		if (error != GLEW_OK) {
+			gl_log_error("ERROR: glewInit failed: %s\n", glewGetErrorString(error));
+			return false;
+		}
+
+		// glewInit may leave an error behind on core profiles
+		gl_clear_error();
+
+		gl_debug_setup();
+
+		GL_CALL(glGenRenderbuffers(1, &color));
+		GL_CALL(glBindRenderbuffer(GL_RENDERBUFFER, color));
+		GL_CALL(glRenderbufferStorage(GL_RENDERBUFFER, GL_RGBA8, window_width, window_height));
+
+		GL_CALL(glGenRenderbuffers(1, &depth));
+		GL_CALL(glBindRenderbuffer(GL_RENDERBUFFER, depth));
+		GL_CALL(glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, window_width, window_height));
+
+		GL_CALL(glGenFramebuffers(1, &framebuffer));
+		GL_CALL(glBindFramebuffer(GL_FRAMEBUFFER, framebuffer));
+		GL_CALL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_RENDERBUFFER, color));
+		GL_CALL(glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depth));
+
+		GLenum status;
+		GL_CALL(status = glCheckFramebufferStatus(GL_FRAMEBUFFER));
+
+		if (status != GL_FRAMEBUFFER_COMPLETE) {
+			gl_log_error("ERROR: incomplete framebuffer 0x%x\n", status);
+			return false;
+		}
+
 		log_gl_params();
 
 		return true;
 	}
 
+	bool is_headless() {
+		return headless;
+	}
+
+	// Frames presented so far
+	size_t frame() {
+		return frame_count;
+	}
+
 	void clear() {
-		assert(window);
+		assert(window || headless);
+
+		// whatever ran since the last frame, ImGui included, may have bound things
+		state.invalidate();
+
 		GL_CALL(glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT));
 		GL_CALL(glViewport(0, 0, window_width, window_height));
 	}
 
 	void render(Mesh* mesh, Shader* shader) {
-		assert(window && mesh && shader);
+		assert((window || headless) && mesh && shader);
 
-		mesh->bind();
-		shader->bind();
+		state.use(shader);
+		state.bind(mesh);
 
 		mesh->draw();
 	}
 
+	// Sorts and issues the draws recorded in the queue
+	void submit(CommandQueue* queue) {
+		assert((window || headless) && queue);
+		queue->submit(state);
+	}
+
+	// Binds made through render() and submit(), for code binding things of its own
+	RenderState& render_state() {
+		return state;
+	}
+
+	// Every frame is handed to capture before it is swapped, nullptr stops
+	void record(Capture* capture) {
+		this->capture = capture;
+	}
+
 	void swap_buffers() {
+		if (capture)
+			capture->frame();
+
+		frame_count++;
+
+		if (headless) {
+			// nothing is shown, but the frame has to be done before the next one
+			GL_CALL(glFinish());
+			return;
+		}
+
 		assert(window);
 		GL_CALL(glfwSwapBuffers(window));
 	}
 
 	void poll_events() {
+		if (headless)
+			return;
+
 		GL_CALL(glfwPollEvents());
 	}
 
 	void close_window() {
+		if (headless) {
+			closing = true;
+			return;
+		}
+
 		assert(window);
 		glfwSetWindowShouldClose(window, GL_TRUE);
 	}
 
 	bool window_should_close() {
+		if (headless)
+			return closing || (frame_limit && frame_count >= frame_limit);
+
 		assert(window);
 		return glfwWindowShouldClose(window);
 	}
@@ -124,13 +295,29 @@ struct Renderer {
 	}
 
 	GLenum pressed(GLenum key) {
+		if (headless)
+			return GLFW_RELEASE;
+
 		assert(window);
 		return glfwGetKey(window, key);
 	}
 
 private:
 
-	GLFWwindow* window;
+	GLFWwindow* window = nullptr;
+
+	bool headless = false;
+	EGLDisplay display = EGL_NO_DISPLAY;
+	EGLContext context = EGL_NO_CONTEXT;
+	GLuint framebuffer = 0, color = 0, depth = 0;
+
+	size_t frame_count = 0;
+	size_t frame_limit = 0;
+	bool closing = false;
+
+	Capture* capture = nullptr;
+
+	RenderState state;
 
 	static void on_window_resize(GLFWwindow* window, int width, int height) {
 		window_width = width;
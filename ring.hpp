@@ -0,0 +1,81 @@
+#pragma once
+
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free queue for many producers and one consumer (Vyukov's).
+// Every cell has a sequence number telling whose turn it is: producers claim a
+// position with a compare and swap and publish it by bumping the sequence, the
+// consumer frees it by moving the sequence one lap ahead. A full queue drops.
+template<typename T>
+struct MpscRing {
+
+	MpscRing(size_t capacity) : cells(capacity), mask(capacity - 1) {
+		assert(capacity >= 2 && (capacity & (capacity - 1)) == 0);
+
+		for (size_t i = 0; i < capacity; i++)
+			cells[i].sequence.store(i, std::memory_order_relaxed);
+	}
+
+	// From any thread, false when full
+	bool push(const T& value) {
+		size_t position = tail.load(std::memory_order_relaxed);
+		Cell* cell;
+
+		while (true) {
+			cell = &cells[position & mask];
+			size_t sequence = cell->sequence.load(std::memory_order_acquire);
+			intptr_t difference = (intptr_t)sequence - (intptr_t)position;
+
+			if (difference == 0) {
+				if (tail.compare_exchange_weak(position, position + 1, std::memory_order_relaxed))
+					break;
+			} else if (difference < 0) {
+				dropped.fetch_add(1, std::memory_order_relaxed);
+				return false;
+			} else {
+				position = tail.load(std::memory_order_relaxed);
+			}
+		}
+
+		cell->value = value;
+		cell->sequence.store(position + 1, std::memory_order_release);
+
+		return true;
+	}
+
+	// From the consumer thread only, false when empty
+	bool pop(T& value) {
+		Cell* cell = &cells[head & mask];
+
+		if (cell->sequence.load(std::memory_order_acquire) != head + 1)
+			return false;
+
+		value = cell->value;
+		cell->sequence.store(head + mask + 1, std::memory_order_release);
+		head++;
+
+		return true;
+	}
+
+	// Values lost to a full queue so far
+	size_t lost() {
+		return dropped.load(std::memory_order_relaxed);
+	}
+
+private:
+	struct Cell {
+		std::atomic<size_t> sequence;
+		T value;
+	};
+
+	std::vector<Cell> cells;
+	size_t mask;
+
+	// producers and the consumer write different lines
+	alignas(64) std::atomic<size_t> tail{0};
+	alignas(64) size_t head = 0;
+	std::atomic<size_t> dropped{0};
+};
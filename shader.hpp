@@ -4,33 +4,93 @@
 
 #include <stdio.h>
 #include <stdarg.h>
+#include <stdint.h>
+#include <string.h>
 #include <time.h>
 
+#include <algorithm>
+#include <string>
+#include <utility>
+#include <vector>
+
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
 #include "log.hpp"
+#include "program_cache.hpp"
 #include "vendor/glm/glm.hpp"
 
 struct Shader {
 	const char* vertex_shader;
+	const char* tess_control_shader = nullptr;
+	const char* tess_evaluation_shader = nullptr;
 	const char* fragment_shader;
+	const char* defines;
+
+	// looked in before compiling and filled after, when set
+	static inline ProgramCache* cache = nullptr;
 
-	Shader(const char* vertex_shader_file, const char* fragment_shader_file);
+	Shader(const char* vertex_shader_file, const char* fragment_shader_file, const char* defines = "");
+	Shader(const char* vertex_shader_file, const char* tess_control_shader_file, const char* tess_evaluation_shader_file, const char* fragment_shader_file, const char* defines = "");
 	~Shader();
 
+	// Rebuilds and waits for it, the program in use stays if the new one does not link
 	void reload();
+	// Starts a rebuild that update() swaps in once linked, restarting any under way
+	void reload_async();
+	// Swaps in a finished rebuild, true when the program changed
+	bool update();
+	bool reloading();
+
 	void bind();
 	void unbind();
 	GLuint id();
 
+	// Bumped by every program swapped in, locations look themselves up again
+	size_t generation();
+
+	// The files read for the program, includes too, as of the last build
+	const std::vector<std::string>& files();
+
+	// Lets the driver compile and link on threads of its own when it can
+	static void parallel_compile();
+
 	struct Location1F uniform1f(const char* name);
 	struct Location1I uniform1i(const char* name);
+	struct Location2I uniform2i(const char* name);
+	struct Location3F uniform3f(const char* name);
+	struct Location4I uniform4i(const char* name);
 	struct LocationMat4F uniformMat4f(const char* name);
 
+	// Reads the uniform block called name from the buffer on binding, kept across reloads
+	void uniform_block(const char* name, GLuint binding);
+
 private:
+	// a program on its way, from the cache or compiling
+	struct Build {
+		GLuint program = 0;
+		std::vector<GLuint> stages;
+		uint64_t key = 0;
+		bool cached = false;
+	};
+
 	GLuint program;
+	size_t program_generation = 0;
+	std::vector<std::pair<std::string, GLuint>> blocks;
+	std::vector<std::string> source_files;
+	Build pending;
+
+	static inline bool parallel = false;
+
+	void bind_blocks(GLuint program);
+	void copy_uniforms(GLuint from, GLuint to);
 	void compile_shaders();
+	Build start_build();
+	bool build_done(const Build& build);
+	bool finish_build(Build& build);
+	void discard(Build& build);
+	GLuint compile_stage(GLenum type, const std::string& source);
+	std::string read_source(const char* filename);
 	char* read_file(const char* filename);
 };
 
@@ -39,7 +99,7 @@ struct Location##NAME { \
 	const char* name; \
 	\
 	Location##NAME(Shader* shader, const char* name) : shader(shader), name(name) { \
-		GL_CALL(location = glGetUniformLocation(shader->id(), name)); \
+		locate(); \
 	} \
 	\
 	TYPE get() { \
@@ -47,6 +107,8 @@ struct Location##NAME { \
 	} \
 	\
 	void set(TYPE value) { \
+		if (seen != shader->generation()) \
+			locate(); \
 		current = value; \
 		GL_CALL(GL_UNIFORM_CALL(shader->id(), location, value)); \
 	} \
@@ -56,8 +118,51 @@ struct Location##NAME { \
 	} \
 	\
 private: \
+	/* locations can move when the program is rebuilt */ \
+	void locate() { \
+		GL_CALL(location = glGetUniformLocation(shader->id(), name)); \
+		seen = shader->generation(); \
+	} \
+	\
 	Shader* shader; \
 	GLint location; \
+	size_t seen; \
+	TYPE current; \
+}
+
+#define VECTOR_LOCATION_CLASS(NAME, TYPE, GL_UNIFORM_CALL) \
+struct Location##NAME { \
+	const char* name; \
+	\
+	Location##NAME(Shader* shader, const char* name) : shader(shader), name(name) { \
+		locate(); \
+	} \
+	\
+	TYPE get() { \
+		return current; \
+	} \
+	\
+	void set(const TYPE& value) { \
+		if (seen != shader->generation()) \
+			locate(); \
+		current = value; \
+		GL_CALL(GL_UNIFORM_CALL(shader->id(), location, 1, &value[0])); \
+	} \
+	\
+	GLint id() { \
+		return location; \
+	} \
+	\
+private: \
+	/* locations can move when the program is rebuilt */ \
+	void locate() { \
+		GL_CALL(location = glGetUniformLocation(shader->id(), name)); \
+		seen = shader->generation(); \
+	} \
+	\
+	Shader* shader; \
+	GLint location; \
+	size_t seen; \
 	TYPE current; \
 }
 
@@ -66,7 +171,7 @@ struct LocationMat##NAME { \
 	const char* name; \
 	\
 	LocationMat##NAME(Shader* shader, const char* name) : shader(shader), name(name) { \
-		GL_CALL(location = glGetUniformLocation(shader->id(), name)); \
+		locate(); \
 	} \
 	\
 	const TYPE* get() { \
@@ -74,6 +179,8 @@ struct LocationMat##NAME { \
 	} \
 	\
 	void set(const TYPE* value) { \
+		if (seen != shader->generation()) \
+			locate(); \
 		current = value; \
 		GL_CALL(GL_UNIFORM_CALL(shader->id(), location, 1, GL_FALSE, &(*value)[0][0])); \
 	} \
@@ -83,26 +190,171 @@ struct LocationMat##NAME { \
 	} \
 	\
 private: \
+	/* locations can move when the program is rebuilt */ \
+	void locate() { \
+		GL_CALL(location = glGetUniformLocation(shader->id(), name)); \
+		seen = shader->generation(); \
+	} \
+	\
 	Shader* shader; \
 	GLint location; \
+	size_t seen; \
 	const TYPE* current = nullptr; \
 }
 
 SCALAR_LOCATION_CLASS(1F, float, glProgramUniform1f);
 SCALAR_LOCATION_CLASS(1I, int, glProgramUniform1i);
+VECTOR_LOCATION_CLASS(2I, glm::ivec2, glProgramUniform2iv);
+VECTOR_LOCATION_CLASS(3F, glm::vec3, glProgramUniform3fv);
+VECTOR_LOCATION_CLASS(4I, glm::ivec4, glProgramUniform4iv);
 MATRIX_LOCATION_CLASS(4F, glm::mat4, glProgramUniformMatrix4fv);
 
-Shader::Shader(const char* vertex_shader_file, const char* fragment_shader_file) : vertex_shader(vertex_shader_file), fragment_shader(fragment_shader_file) {
+// A std140 uniform block kept on the CPU as a T laid out to match, on its own
+// binding point so every program using the block shares it. Changes only mark
+// the bytes they touch, upload() sends the span between the first and last
+// changed byte, once per frame whatever number of sets came before.
+template<typename T>
+struct UniformBuffer {
+
+	UniformBuffer(GLuint binding, const T& initial = T()) : block(initial), binding_point(binding) {
+		GL_CALL(glGenBuffers(1, &buffer));
+		GL_CALL(glBindBuffer(GL_UNIFORM_BUFFER, buffer));
+		GL_CALL(glBufferData(GL_UNIFORM_BUFFER, sizeof(T), &block, GL_DYNAMIC_DRAW));
+		GL_CALL(glBindBufferBase(GL_UNIFORM_BUFFER, binding, buffer));
+	}
+
+	~UniformBuffer() {
+		GL_CALL(glDeleteBuffers(1, &buffer));
+	}
+
+	const T& get() {
+		return block;
+	}
+
+	// The whole block, only the bytes that differ are marked
+	void set(const T& value) {
+		const uint8_t* current = (const uint8_t*)&block;
+		const uint8_t* next = (const uint8_t*)&value;
+
+		size_t first = 0;
+		size_t last = sizeof(T);
+
+		while (first < last && current[first] == next[first])
+			first++;
+
+		while (last > first && current[last - 1] == next[last - 1])
+			last--;
+
+		if (first == last)
+			return;
+
+		memcpy((uint8_t*)&block + first, next + first, last - first);
+		mark(first, last);
+	}
+
+	// One member of the block, as in set(block.get().count, 3)
+	template<typename M>
+	void set(const M& member, const M& value) {
+		const size_t offset = (const uint8_t*)&member - (const uint8_t*)&block;
+		assert(offset + sizeof(M) <= sizeof(T) && "member outside the block");
+
+		if (!memcmp(&member, &value, sizeof(M)))
+			return;
+
+		memcpy((uint8_t*)&block + offset, &value, sizeof(M));
+		mark(offset, offset + sizeof(M));
+	}
+
+	// Sends what changed since the last upload, if anything
+	void upload() {
+		if (dirty_begin >= dirty_end)
+			return;
+
+		GL_CALL(glBindBuffer(GL_UNIFORM_BUFFER, buffer));
+		GL_CALL(glBufferSubData(GL_UNIFORM_BUFFER, dirty_begin, dirty_end - dirty_begin, (const uint8_t*)&block + dirty_begin));
+
+		dirty_begin = sizeof(T);
+		dirty_end = 0;
+	}
+
+	GLuint binding() {
+		return binding_point;
+	}
+
+private:
+	void mark(size_t begin, size_t end) {
+		dirty_begin = std::min(dirty_begin, begin);
+		dirty_end = std::max(dirty_end, end);
+	}
+
+	T block;
+	GLuint binding_point;
+	GLuint buffer;
+
+	size_t dirty_begin = sizeof(T);
+	size_t dirty_end = 0;
+};
+
+Shader::Shader(const char* vertex_shader_file, const char* fragment_shader_file, const char* defines) : vertex_shader(vertex_shader_file), fragment_shader(fragment_shader_file), defines(defines) {
+	compile_shaders();
+}
+
+Shader::Shader(const char* vertex_shader_file, const char* tess_control_shader_file, const char* tess_evaluation_shader_file, const char* fragment_shader_file, const char* defines) : vertex_shader(vertex_shader_file), tess_control_shader(tess_control_shader_file), tess_evaluation_shader(tess_evaluation_shader_file), fragment_shader(fragment_shader_file), defines(defines) {
 	compile_shaders();
 }
 
 Shader::~Shader() {
+	discard(pending);
 	GL_CALL(glDeleteProgram(program));
 }
 
 void Shader::reload() {
+	discard(pending);
+
+	Build build = start_build();
+
+	if (!finish_build(build)) {
+		gl_log_error("ERROR: reload failed, keeping program %u\n", program);
+		discard(build);
+		return;
+	}
+
+	copy_uniforms(program, build.program);
+
 	GL_CALL(glDeleteProgram(program));
-	compile_shaders();
+	program = build.program;
+	program_generation++;
+}
+
+void Shader::reload_async() {
+	discard(pending);
+	pending = start_build();
+}
+
+bool Shader::update() {
+	if (!pending.program || !build_done(pending))
+		return false;
+
+	Build build = pending;
+	pending = Build();
+
+	if (!finish_build(build)) {
+		gl_log_error("ERROR: reload failed, keeping program %u\n", program);
+		discard(build);
+		return false;
+	}
+
+	copy_uniforms(program, build.program);
+
+	GL_CALL(glDeleteProgram(program));
+	program = build.program;
+	program_generation++;
+
+	return true;
+}
+
+bool Shader::reloading() {
+	return pending.program != 0;
 }
 
 void Shader::bind() {
@@ -117,6 +369,30 @@ GLuint Shader::id() {
 	return program;
 }
 
+size_t Shader::generation() {
+	return program_generation;
+}
+
+const std::vector<std::string>& Shader::files() {
+	return source_files;
+}
+
+void Shader::parallel_compile() {
+#ifdef GLEW_KHR_parallel_shader_compile
+	if (GLEW_KHR_parallel_shader_compile) {
+		// as many threads as the driver likes
+		GL_CALL(glMaxShaderCompilerThreadsKHR(0xffffffff));
+		parallel = true;
+		return;
+	}
+#endif
+
+	if (GLEW_ARB_parallel_shader_compile) {
+		GL_CALL(glMaxShaderCompilerThreadsARB(0xffffffff));
+		parallel = true;
+	}
+}
+
 Location1F Shader::uniform1f(const char* name) {
 	return Location1F(this, name);
 }
@@ -125,43 +401,336 @@ Location1I Shader::uniform1i(const char* name) {
 	return Location1I(this, name);
 }
 
+Location2I Shader::uniform2i(const char* name) {
+	return Location2I(this, name);
+}
+
+Location3F Shader::uniform3f(const char* name) {
+	return Location3F(this, name);
+}
+
+Location4I Shader::uniform4i(const char* name) {
+	return Location4I(this, name);
+}
+
 LocationMat4F Shader::uniformMat4f(const char* name) {
 	return LocationMat4F(this, name);
 }
 
+void Shader::uniform_block(const char* name, GLuint binding) {
+	blocks.emplace_back(name, binding);
+	bind_blocks(program);
+}
+
+// Programs without the block, like the ocean ones for Waves, are left alone
+void Shader::bind_blocks(GLuint program) {
+	for (const auto& [name, binding] : blocks) {
+		GLuint index;
+		GL_CALL(index = glGetUniformBlockIndex(program, name.c_str()));
+
+		if (index != GL_INVALID_INDEX) {
+			GL_CALL(glUniformBlockBinding(program, index, binding));
+		}
+	}
+}
+
+// Uniforms the old program set are set the same in the new one before it goes
+// live, not left at their defaults until each Location is set again. The ones
+// renamed or retyped by the edit keep their defaults.
+void Shader::copy_uniforms(GLuint from, GLuint to) {
+	GLint count = 0, length = 0;
+	GL_CALL(glGetProgramiv(from, GL_ACTIVE_UNIFORMS, &count));
+	GL_CALL(glGetProgramiv(from, GL_ACTIVE_UNIFORM_MAX_LENGTH, &length));
+
+	std::vector<char> listed(std::max(length, 1));
+
+	for (GLint i = 0; i < count; i++) {
+		GLint size;
+		GLenum type;
+		GL_CALL(glGetActiveUniform(from, i, listed.size(), nullptr, &size, &type, listed.data()));
+
+		const char* name = listed.data();
+		GLuint index;
+		GL_CALL(glGetUniformIndices(to, 1, &name, &index));
+
+		if (index == GL_INVALID_INDEX)
+			continue;
+
+		GLint target_type, target_size;
+		GL_CALL(glGetActiveUniformsiv(to, 1, &index, GL_UNIFORM_TYPE, &target_type));
+		GL_CALL(glGetActiveUniformsiv(to, 1, &index, GL_UNIFORM_SIZE, &target_size));
+
+		if ((GLenum)target_type != type)
+			continue;
+
+		// arrays are listed once as name[0]
+		std::string base(name);
+
+		if (size > 1 && base.size() > 3 && !base.compare(base.size() - 3, 3, "[0]"))
+			base.resize(base.size() - 3);
+
+		for (GLint element = 0; element < std::min(size, target_size); element++) {
+			const std::string element_name = size > 1 ? base + "[" + std::to_string(element) + "]" : base;
+
+			GLint source, target;
+			GL_CALL(source = glGetUniformLocation(from, element_name.c_str()));
+			GL_CALL(target = glGetUniformLocation(to, element_name.c_str()));
+
+			// block members have no location, their buffer is shared anyway
+			if (source < 0 || target < 0)
+				continue;
+
+			GLfloat floats[16];
+			GLint ints[4];
+			GLuint uints[4];
+
+			switch (type) {
+			case GL_FLOAT:
+				GL_CALL(glGetUniformfv(from, source, floats));
+				GL_CALL(glProgramUniform1fv(to, target, 1, floats));
+				break;
+			case GL_FLOAT_VEC2:
+				GL_CALL(glGetUniformfv(from, source, floats));
+				GL_CALL(glProgramUniform2fv(to, target, 1, floats));
+				break;
+			case GL_FLOAT_VEC3:
+				GL_CALL(glGetUniformfv(from, source, floats));
+				GL_CALL(glProgramUniform3fv(to, target, 1, floats));
+				break;
+			case GL_FLOAT_VEC4:
+				GL_CALL(glGetUniformfv(from, source, floats));
+				GL_CALL(glProgramUniform4fv(to, target, 1, floats));
+				break;
+			case GL_FLOAT_MAT2:
+				GL_CALL(glGetUniformfv(from, source, floats));
+				GL_CALL(glProgramUniformMatrix2fv(to, target, 1, GL_FALSE, floats));
+				break;
+			case GL_FLOAT_MAT3:
+				GL_CALL(glGetUniformfv(from, source, floats));
+				GL_CALL(glProgramUniformMatrix3fv(to, target, 1, GL_FALSE, floats));
+				break;
+			case GL_FLOAT_MAT4:
+				GL_CALL(glGetUniformfv(from, source, floats));
+				GL_CALL(glProgramUniformMatrix4fv(to, target, 1, GL_FALSE, floats));
+				break;
+			case GL_INT:
+			case GL_BOOL:
+				GL_CALL(glGetUniformiv(from, source, ints));
+				GL_CALL(glProgramUniform1iv(to, target, 1, ints));
+				break;
+			case GL_INT_VEC2:
+			case GL_BOOL_VEC2:
+				GL_CALL(glGetUniformiv(from, source, ints));
+				GL_CALL(glProgramUniform2iv(to, target, 1, ints));
+				break;
+			case GL_INT_VEC3:
+			case GL_BOOL_VEC3:
+				GL_CALL(glGetUniformiv(from, source, ints));
+				GL_CALL(glProgramUniform3iv(to, target, 1, ints));
+				break;
+			case GL_INT_VEC4:
+			case GL_BOOL_VEC4:
+				GL_CALL(glGetUniformiv(from, source, ints));
+				GL_CALL(glProgramUniform4iv(to, target, 1, ints));
+				break;
+			case GL_UNSIGNED_INT:
+				GL_CALL(glGetUniformuiv(from, source, uints));
+				GL_CALL(glProgramUniform1uiv(to, target, 1, uints));
+				break;
+			case GL_UNSIGNED_INT_VEC2:
+				GL_CALL(glGetUniformuiv(from, source, uints));
+				GL_CALL(glProgramUniform2uiv(to, target, 1, uints));
+				break;
+			case GL_UNSIGNED_INT_VEC3:
+				GL_CALL(glGetUniformuiv(from, source, uints));
+				GL_CALL(glProgramUniform3uiv(to, target, 1, uints));
+				break;
+			case GL_UNSIGNED_INT_VEC4:
+				GL_CALL(glGetUniformuiv(from, source, uints));
+				GL_CALL(glProgramUniform4uiv(to, target, 1, uints));
+				break;
+			case GL_SAMPLER_1D: case GL_SAMPLER_2D: case GL_SAMPLER_3D: case GL_SAMPLER_CUBE: case GL_SAMPLER_2D_ARRAY: case GL_SAMPLER_2D_SHADOW:
+			case GL_INT_SAMPLER_2D: case GL_UNSIGNED_INT_SAMPLER_2D: case GL_SAMPLER_BUFFER:
+				// the texture unit
+				GL_CALL(glGetUniformiv(from, source, ints));
+				GL_CALL(glProgramUniform1iv(to, target, 1, ints));
+				break;
+			default:
+				gl_log("uniform %s of type 0x%x not carried over the reload\n", element_name.c_str(), type);
+				break;
+			}
+		}
+	}
+}
+
 void Shader::compile_shaders() {
-	char* vs_string = read_file(vertex_shader);
-	char* fs_string = read_file(fragment_shader);
+	Build build = start_build();
+	finish_build(build);
+	program = build.program;
+}
+
+// Everything up to the link, which the driver may still be doing on return
+Shader::Build Shader::start_build() {
+	// tessellation stages come in pairs
+	assert(!tess_control_shader == !tess_evaluation_shader);
+
+	source_files.clear();
+
+	std::vector<std::string> sources = {read_source(vertex_shader), read_source(fragment_shader)};
+	std::vector<GLenum> types = {GL_VERTEX_SHADER, GL_FRAGMENT_SHADER};
+
+	if (tess_control_shader) {
+		sources.push_back(read_source(tess_control_shader));
+		sources.push_back(read_source(tess_evaluation_shader));
+		types.push_back(GL_TESS_CONTROL_SHADER);
+		types.push_back(GL_TESS_EVALUATION_SHADER);
+	}
+
+	Build build;
+	GL_CALL(build.program = glCreateProgram());
+
+	if (cache && cache->enabled()) {
+		std::vector<std::string> pieces = sources;
+		pieces.push_back(defines);
+		build.key = cache->key(pieces);
 
-	GL_CALL(GLuint vs = glCreateShader(GL_VERTEX_SHADER));
-	GL_CALL(glShaderSource(vs, 1, &vs_string, NULL));
-	GL_CALL(glCompileShader(vs));
+		if (cache->load(build.key, build.program)) {
+			build.cached = true;
+			return build;
+		}
 
-	log_shader_info(vs, "vertex shader");
+		GL_CALL(glProgramParameteri(build.program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE));
+	}
+
+	for (size_t i = 0; i < sources.size(); i++) {
+		GLuint stage = compile_stage(types[i], sources[i]);
+		GL_CALL(glAttachShader(build.program, stage));
+		build.stages.push_back(stage);
+	}
 
-	GL_CALL(GLuint fs = glCreateShader(GL_FRAGMENT_SHADER));
-	GL_CALL(glShaderSource(fs, 1, &fs_string, NULL));
-	GL_CALL(glCompileShader(fs));
+	GL_CALL(glLinkProgram(build.program));
 
-	log_shader_info(fs, "fragment shader");
+	return build;
+}
+
+// Without parallel compilation the link is done once glLinkProgram returns
+bool Shader::build_done(const Build& build) {
+	if (!parallel || build.cached)
+		return true;
 
-	GL_CALL(program = glCreateProgram());
-	GL_CALL(glAttachShader(program, fs));
-	GL_CALL(glAttachShader(program, vs));
-	GL_CALL(glLinkProgram(program));
+	GLint done = GL_TRUE;
+	GL_CALL(glGetProgramiv(build.program, GL_COMPLETION_STATUS_KHR, &done));
 
-	log_program_info(program, "shader program");
+	return done == GL_TRUE;
+}
+
+// Waits for the link if needed, false when it failed
+bool Shader::finish_build(Build& build) {
+	const char* names[] = {"vertex shader", "fragment shader", "tessellation control shader", "tessellation evaluation shader"};
+
+	for (size_t i = 0; i < build.stages.size(); i++)
+		log_shader_info(build.stages[i], names[i]);
+
+	log_program_info(build.program, "shader program");
 
 	int params = -1;
-	GL_CALL(glGetProgramiv(program, GL_LINK_STATUS, &params));
+	GL_CALL(glGetProgramiv(build.program, GL_LINK_STATUS, &params));
+
+	// the program keeps them alive until it is deleted
+	for (GLuint stage : build.stages) {
+		GL_CALL(glDeleteShader(stage));
+	}
+
+	build.stages.clear();
 
 	if (GL_TRUE != params) {
-		print_all(program);
-		gl_log_error("ERROR: could not link shader program GL index %u\n", program);
+		print_all(build.program);
+		gl_log_error("ERROR: could not link shader program GL index %u\n", build.program);
+		return false;
+	}
+
+	if (cache && cache->enabled() && !build.cached)
+		cache->store(build.key, build.program);
+
+	bind_blocks(build.program);
+
+	return true;
+}
+
+void Shader::discard(Build& build) {
+	for (GLuint stage : build.stages) {
+		GL_CALL(glDeleteShader(stage));
+	}
+
+	if (build.program) {
+		GL_CALL(glDeleteProgram(build.program));
+	}
+
+	build = Build();
+}
+
+GLuint Shader::compile_stage(GLenum type, const std::string& source) {
+	// defines have to go right after the #version line
+	size_t body = source.find('\n');
+	body = body == std::string::npos ? source.size() : body + 1;
+
+	std::string header = std::string(defines) + "#line 2\n";
+
+	const char* strings[] = {source.c_str(), header.c_str(), source.c_str() + body};
+	const GLint lengths[] = {(GLint)body, -1, -1};
+
+	GLuint shader;
+	GL_CALL(shader = glCreateShader(type));
+	GL_CALL(glShaderSource(shader, 3, strings, lengths));
+	GL_CALL(glCompileShader(shader));
+
+	return shader;
+}
+
+// Source of a stage with its #include "file" lines expanded, paths are relative to the includer
+std::string Shader::read_source(const char* filename) {
+	source_files.push_back(filename);
+
+	char* contents = read_file(filename);
+
+	if (!contents)
+		return std::string();
+
+	std::string directory(filename);
+	size_t slash = directory.rfind('/');
+	directory = slash == std::string::npos ? std::string() : directory.substr(0, slash + 1);
+
+	std::string source;
+	int line = 1;
+
+	for (const char* begin = contents; *begin; line++) {
+		const char* end = strchr(begin, '\n');
+		end = end ? end + 1 : begin + strlen(begin);
+
+		const char* include = "#include \"";
+
+		if (!strncmp(begin, include, strlen(include))) {
+			const char* name = begin + strlen(include);
+			const char* quote = strchr(name, '"');
+
+			if (quote && quote < end) {
+				std::string path = directory + std::string(name, quote);
+
+				source += read_source(path.c_str());
+				source += "\n#line " + std::to_string(line + 1) + "\n";
+
+				begin = end;
+				continue;
+			}
+		}
+
+		source.append(begin, end);
+		begin = end;
 	}
 
-	delete vs_string;
-	delete fs_string;
+	delete[] contents;
+
+	return source;
 }
 
 char* Shader::read_file(const char* filename) {
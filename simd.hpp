@@ -0,0 +1,39 @@
+#pragma once
+
+#if defined(__x86_64__) || defined(__i386__)
+#define SIMD_X86 1
+#include <immintrin.h>
+// kernels tagged with these are only called after simd_detect() says the CPU has them
+#define SIMD_TARGET_SSE __attribute__((target("sse2")))
+#define SIMD_TARGET_AVX2 __attribute__((target("avx2,fma")))
+#else
+#define SIMD_X86 0
+#endif
+
+enum class SimdLevel {
+	SCALAR,
+	SSE,
+	AVX2,
+};
+
+SimdLevel simd_detect() {
+#if SIMD_X86
+	__builtin_cpu_init();
+
+	if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+		return SimdLevel::AVX2;
+
+	if (__builtin_cpu_supports("sse2"))
+		return SimdLevel::SSE;
+#endif
+	return SimdLevel::SCALAR;
+}
+
+const char* simd_name(SimdLevel level) {
+	switch (level) {
+		case SimdLevel::SCALAR: return "scalar";
+		case SimdLevel::SSE: return "sse";
+		case SimdLevel::AVX2: return "avx2";
+	}
+	return "unknown";
+}
@@ -0,0 +1,151 @@
+#pragma once
+
+#include <cassert>
+#include <cstdint>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "log.hpp"
+
+// A buffer rewritten every frame without making the driver wait or copy. It
+// is cut in regions used round robin, each one fenced once the draws reading
+// it are issued, so the CPU fills the next region while the GPU still reads
+// the previous ones and only waits when it laps the GPU.
+//
+// With ARB_buffer_storage the whole buffer is mapped once, persistent and
+// coherent. Without it every region is mapped unsynchronized on its turn, the
+// fences take the place of the driver's own synchronization.
+struct StreamBuffer {
+
+	StreamBuffer(GLenum target, GLsizeiptr region_size, size_t regions = 3)
+		: target(target), region_size(region_size), fences(regions, nullptr) {
+		assert(region_size > 0 && regions > 0);
+
+		const GLsizeiptr size = region_size * regions;
+
+		GL_CALL(glGenBuffers(1, &buffer));
+		GL_CALL(glBindBuffer(target, buffer));
+
+		persistent = GLEW_ARB_buffer_storage;
+
+		if (persistent) {
+			const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+
+			GL_CALL(glBufferStorage(target, size, nullptr, flags));
+			GL_CALL(mapped = (uint8_t*)glMapBufferRange(target, 0, size, flags));
+		} else {
+			GL_CALL(glBufferData(target, size, nullptr, GL_STREAM_DRAW));
+		}
+
+		GL_CALL(glBindBuffer(target, 0));
+	}
+
+	~StreamBuffer() {
+		for (GLsync fence : fences) {
+			if (fence) {
+				GL_CALL(glDeleteSync(fence));
+			}
+		}
+
+		if (persistent) {
+			GL_CALL(glBindBuffer(target, buffer));
+			GL_CALL(glUnmapBuffer(target));
+		}
+
+		GL_CALL(glDeleteBuffers(1, &buffer));
+	}
+
+	// The current region to write into, once the GPU is done reading it
+	void* map() {
+		wait(fences[region]);
+
+		if (persistent)
+			return mapped + offset();
+
+		const GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_UNSYNCHRONIZED_BIT | GL_MAP_INVALIDATE_RANGE_BIT;
+
+		void* pointer;
+		GL_CALL(glBindBuffer(target, buffer));
+		GL_CALL(pointer = glMapBufferRange(target, offset(), region_size, flags));
+
+		return pointer;
+	}
+
+	// Ends the writes, returns where the region starts in the buffer
+	GLintptr unmap() {
+		if (!persistent) {
+			GL_CALL(glBindBuffer(target, buffer));
+			GL_CALL(glUnmapBuffer(target));
+		}
+
+		return offset();
+	}
+
+	// After the draws that read the region, moves on to the next one
+	void fence() {
+		GL_CALL(fences[region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0));
+		region = (region + 1) % fences.size();
+	}
+
+	GLuint id() {
+		return buffer;
+	}
+
+	GLintptr offset() {
+		return region * region_size;
+	}
+
+	GLsizeiptr capacity() {
+		return region_size;
+	}
+
+	bool is_persistent() {
+		return persistent;
+	}
+
+	// Times map() had to wait for the GPU
+	size_t stalls() {
+		return stall_count;
+	}
+
+private:
+	void wait(GLsync& fence) {
+		if (!fence)
+			return;
+
+		GLenum status;
+		GL_CALL(status = glClientWaitSync(fence, 0, 0));
+
+		if (status == GL_TIMEOUT_EXPIRED) {
+			stall_count++;
+
+			// flushing the first time round makes sure the fence gets there
+			GLbitfield flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+
+			do {
+				GL_CALL(status = glClientWaitSync(fence, flags, 1000000));
+				flags = 0;
+			} while (status == GL_TIMEOUT_EXPIRED);
+		}
+
+		if (status == GL_WAIT_FAILED)
+			gl_log_error("ERROR: stream buffer fence failed\n");
+
+		GL_CALL(glDeleteSync(fence));
+		fence = nullptr;
+	}
+
+	GLenum target;
+	GLuint buffer;
+	GLsizeiptr region_size;
+
+	std::vector<GLsync> fences;
+	size_t region = 0;
+
+	bool persistent;
+	uint8_t* mapped = nullptr;
+
+	size_t stall_count = 0;
+};
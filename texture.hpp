@@ -3,6 +3,9 @@
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
 
+#include <cstring>
+
+#include "baked_texture.hpp"
 #include "log.hpp"
 #include "vendor/stb/stb_image.hpp"
 
@@ -12,8 +15,26 @@ struct Texture {
 	stbi_uc* buffer;
 	int width, height;
 	int channels;
+	GLenum format = GL_RGBA;
+	GLenum type = GL_UNSIGNED_BYTE;
+
+	Texture(const char* path) : path(path), buffer(nullptr), width(0), height(0), channels(4) {
+		// baked files skip the decode, see baked_texture.hpp
+		const size_t length = strlen(path);
+
+		if (length > 5 && !strcmp(path + length - 5, ".wtex")) {
+			GL_CALL(glGenTextures(1, &texture));
+
+			BakedTexture baked(path);
+
+			if (baked.valid())
+				upload(baked);
+			else
+				gl_log_error("Failed to load baked texture: %s\n", path);
+
+			return;
+		}
 
-	Texture(const char* path) : path(path) {
 		// OpenGL expects the 0.0 coordinate on the Y-axis to be on the bottom
 		stbi_set_flip_vertically_on_load(true);
 
@@ -40,6 +61,36 @@ struct Texture {
 			gl_log_error("Failed to load texture: %s", path);
 	}
 
+	// From a mapped baked file, every level goes to OpenGL straight from the mapping
+	Texture(const BakedTexture& baked) : path(nullptr), buffer(nullptr), width(0), height(0), channels(4) {
+		GL_CALL(glGenTextures(1, &texture));
+		upload(baked);
+	}
+
+	// Empty texture for data made on the CPU, filled with update()
+	Texture(int width, int height, GLenum internal_format, GLenum format, GLenum type, GLenum wrap = GL_REPEAT)
+		: path(nullptr), buffer(nullptr), width(width), height(height), channels(0), format(format), type(type) {
+		GL_CALL(glGenTextures(1, &texture));
+
+		bind();
+
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR));
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, wrap));
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, wrap));
+
+		GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, internal_format, width, height, 0, format, type, nullptr));
+
+		unbind();
+	}
+
+	// Replaces the whole image, data has the format and type given at creation
+	void update(const void* data) {
+		GL_CALL(glBindTexture(GL_TEXTURE_2D, texture));
+		GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, 0, 0, 0, width, height, format, type, data));
+		unbind();
+	}
+
 	~Texture() {
 		GL_CALL(glDeleteTextures(1, &texture));
 	}
@@ -52,4 +103,39 @@ struct Texture {
 	void unbind() {
 		GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
 	}
+
+private:
+	void upload(const BakedTexture& baked) {
+		const BakedHeader& header = baked.header();
+		const bool compressed = header.format == BakedFormat::BC1;
+
+		width = header.width;
+		height = header.height;
+
+		bind();
+
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE));
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE));
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header.levels - 1));
+
+		if (compressed && !GLEW_EXT_texture_compression_s3tc)
+			gl_log("%s: no S3TC, decoding BC1 on the CPU\n", path ? path : "baked texture");
+
+		for (uint32_t i = 0; i < header.levels; i++) {
+			const BakedLevel& level = baked.level(i);
+
+			if (!compressed) {
+				GL_CALL(glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, baked.data(i)));
+			} else if (GLEW_EXT_texture_compression_s3tc) {
+				GL_CALL(glCompressedTexImage2D(GL_TEXTURE_2D, i, GL_COMPRESSED_RGB_S3TC_DXT1_EXT, level.width, level.height, 0, level.size, baked.data(i)));
+			} else {
+				std::vector<uint8_t> pixels = bc1_decode(baked.data(i), level.width, level.height);
+				GL_CALL(glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, level.width, level.height, 0, GL_RGBA, GL_UNSIGNED_BYTE, pixels.data()));
+			}
+		}
+
+		unbind();
+	}
 };
\ No newline at end of file
@@ -0,0 +1,308 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "job_system.hpp"
+#include "log.hpp"
+#include "mipmap.hpp"
+#include "stream_buffer.hpp"
+#include "vendor/glm/glm.hpp"
+#include "vendor/stb/stb_image.hpp"
+
+// A texture that arrives over several frames. Until its first mip level is on
+// the GPU, id() is a one pixel placeholder of a chosen colour; after that the
+// levels go up from the smallest, and the base level follows the finest one
+// uploaded, so the texture sharpens as it streams in.
+struct StreamedTexture {
+
+	GLuint id() {
+		return base_level < levels ? texture : placeholder;
+	}
+
+	void bind(unsigned int slot = 0) {
+		GL_CALL(glActiveTexture(GL_TEXTURE0 + slot));
+		GL_CALL(glBindTexture(GL_TEXTURE_2D, id()));
+	}
+
+	// Every level is uploaded
+	bool resident() {
+		return levels && base_level == 0;
+	}
+
+	// Could not be read, stays the placeholder
+	bool failed() {
+		return broken;
+	}
+
+	const char* path;
+	int width = 0, height = 0;
+
+private:
+	friend struct TextureStream;
+
+	StreamedTexture(const char* path, const glm::vec4& color, GLenum wrap) : path(path), wrap(wrap) {
+		GL_CALL(glGenTextures(1, &placeholder));
+		GL_CALL(glBindTexture(GL_TEXTURE_2D, placeholder));
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_NEAREST));
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_NEAREST));
+		GL_CALL(glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, 1, 1, 0, GL_RGBA, GL_FLOAT, &color[0]));
+		GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+	}
+
+	~StreamedTexture() {
+		GL_CALL(glDeleteTextures(1, &placeholder));
+
+		if (texture) {
+			GL_CALL(glDeleteTextures(1, &texture));
+		}
+	}
+
+	GLuint placeholder = 0;
+	GLuint texture = 0;
+	GLenum wrap;
+
+	// levels - 1 is the smallest, base_level == levels while nothing is uploaded
+	int levels = 0;
+	int base_level = 0;
+	bool broken = false;
+};
+
+// Loads textures without stalling the frame. Files are decoded, and their mip
+// chains box filtered, as jobs, several textures at once. update(),
+// once a frame on the GL thread, copies at most budget bytes of levels into a
+// pixel unpack StreamBuffer and uploads from there, so a big texture is spread
+// over as many frames as it needs instead of one long hitch.
+struct TextureStream {
+
+	TextureStream(JobSystem* jobs, size_t budget = 4 << 20) : jobs(jobs), staging(GL_PIXEL_UNPACK_BUFFER, budget) {
+	}
+
+	~TextureStream() {
+		// decodes still running write into the textures
+		jobs->wait(decoding);
+
+		for (StreamedTexture* texture : textures)
+			delete texture;
+	}
+
+	// Queues an RGBA image file, the texture is usable right away and owned by the stream
+	StreamedTexture* load(const char* path, const glm::vec4& placeholder = glm::vec4(0.5f, 0.5f, 0.5f, 1.0f), GLenum wrap = GL_REPEAT) {
+		StreamedTexture* texture = new StreamedTexture(path, placeholder, wrap);
+		textures.push_back(texture);
+
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+			outstanding++;
+		}
+
+		jobs->run([this, texture] { decode(texture); }, &decoding);
+
+		return texture;
+	}
+
+	// Uploads up to the budget, call once a frame
+	void update() {
+		{
+			std::lock_guard<std::mutex> lock(mutex);
+
+			while (!decoded.empty()) {
+				uploads.push_back(std::move(decoded.front()));
+				decoded.pop_front();
+			}
+		}
+
+		if (uploads.empty())
+			return;
+
+		struct Copy {
+			Upload* upload;
+			int level, row, rows;
+			size_t offset;
+		};
+
+		std::vector<Copy> copies;
+
+		const size_t budget = staging.capacity();
+		uint8_t* target = (uint8_t*)staging.map();
+		size_t used = 0;
+
+		for (Upload& upload : uploads) {
+			while (upload.level >= 0) {
+				const MipLevel& level = upload.levels[upload.level];
+				const size_t row_bytes = level.width * 4;
+				const int rows = std::min<int>((budget - used) / row_bytes, level.height - upload.row);
+
+				if (rows <= 0)
+					break;
+
+				memcpy(target + used, level.pixels.data() + upload.row * row_bytes, rows * row_bytes);
+				copies.push_back({&upload, upload.level, upload.row, rows, used});
+
+				used += rows * row_bytes;
+				upload.row += rows;
+
+				if (upload.row == level.height) {
+					upload.level--;
+					upload.row = 0;
+				}
+			}
+
+			if (upload.level >= 0)
+				break;
+		}
+
+		const GLintptr offset = staging.unmap();
+
+		// storage is made with no data, unmap() may leave the unpack buffer bound
+		// and glTexImage2D would then read from it
+		GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+
+		for (const Copy& copy : copies) {
+			if (!copy.upload->texture->texture)
+				allocate(*copy.upload);
+		}
+
+		GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging.id()));
+		GL_CALL(glPixelStorei(GL_UNPACK_ALIGNMENT, 4));
+
+		for (const Copy& copy : copies) {
+			StreamedTexture* texture = copy.upload->texture;
+			const MipLevel& level = copy.upload->levels[copy.level];
+
+			GL_CALL(glBindTexture(GL_TEXTURE_2D, texture->texture));
+			GL_CALL(glTexSubImage2D(GL_TEXTURE_2D, copy.level, 0, copy.row, level.width, copy.rows, GL_RGBA, GL_UNSIGNED_BYTE, (const void*)(offset + copy.offset)));
+
+			// a whole level is there, sampling can start from it
+			if (copy.row + copy.rows == level.height) {
+				GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, copy.level));
+				texture->base_level = copy.level;
+			}
+		}
+
+		GL_CALL(glBindTexture(GL_TEXTURE_2D, 0));
+		GL_CALL(glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0));
+
+		staging.fence();
+
+		if (copies.empty() && used == 0) {
+			// a row wider than the whole budget could never go
+			gl_log_error("ERROR: %s has rows larger than the %zu byte streaming budget\n", uploads.front().texture->path, budget);
+			uploads.front().texture->broken = true;
+			uploads.pop_front();
+			finished();
+		}
+
+		while (!uploads.empty() && uploads.front().level < 0) {
+			uploads.pop_front();
+			finished();
+		}
+	}
+
+	// Textures not resident or failed yet
+	size_t pending() {
+		std::lock_guard<std::mutex> lock(mutex);
+		return outstanding;
+	}
+
+	// Runs update() until everything is resident, for loading screens and tests
+	void finish() {
+		while (pending()) {
+			update();
+			std::this_thread::yield();
+		}
+	}
+
+private:
+	struct Upload {
+		StreamedTexture* texture;
+		std::vector<MipLevel> levels;
+		// next level and row to copy, the smallest level goes first
+		int level;
+		int row;
+	};
+
+	void finished() {
+		std::lock_guard<std::mutex> lock(mutex);
+		outstanding--;
+	}
+
+	void allocate(Upload& upload) {
+		StreamedTexture* texture = upload.texture;
+		const int levels = upload.levels.size();
+
+		GL_CALL(glGenTextures(1, &texture->texture));
+		GL_CALL(glBindTexture(GL_TEXTURE_2D, texture->texture));
+
+		// one allocation for the whole chain when the driver can, level by level otherwise
+		if (GLEW_ARB_texture_storage) {
+			GL_CALL(glTexStorage2D(GL_TEXTURE_2D, levels, GL_RGBA8, upload.levels[0].width, upload.levels[0].height));
+		} else {
+			for (int i = 0; i < levels; i++) {
+				GL_CALL(glTexImage2D(GL_TEXTURE_2D, i, GL_RGBA8, upload.levels[i].width, upload.levels[i].height, 0, GL_RGBA, GL_UNSIGNED_BYTE, nullptr));
+			}
+		}
+
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR));
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR));
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, texture->wrap));
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, texture->wrap));
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levels - 1));
+		GL_CALL(glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, levels - 1));
+
+		texture->levels = levels;
+		texture->base_level = levels;
+	}
+
+	// One file and its mip chain, a job on any thread
+	void decode(StreamedTexture* texture) {
+		// OpenGL expects the 0.0 coordinate on the Y-axis to be on the bottom
+		stbi_set_flip_vertically_on_load_thread(true);
+
+		int width, height, channels;
+		stbi_uc* pixels = stbi_load(texture->path, &width, &height, &channels, 4);
+
+		if (!pixels) {
+			gl_log_error("ERROR: could not stream texture %s: %s\n", texture->path, stbi_failure_reason());
+
+			std::lock_guard<std::mutex> lock(mutex);
+			texture->broken = true;
+			outstanding--;
+			return;
+		}
+
+		texture->width = width;
+		texture->height = height;
+
+		Upload upload = {texture, mip_chain(width, height, pixels), 0, 0};
+		upload.level = upload.levels.size() - 1;
+		stbi_image_free(pixels);
+
+		std::lock_guard<std::mutex> lock(mutex);
+		decoded.push_back(std::move(upload));
+	}
+
+	JobSystem* jobs;
+	StreamBuffer staging;
+	std::vector<StreamedTexture*> textures;
+
+	// uploads in progress, only touched by the GL thread
+	std::deque<Upload> uploads;
+
+	// decode jobs not done yet
+	JobCounter decoding;
+
+	std::mutex mutex;
+	std::deque<Upload> decoded;
+	size_t outstanding = 0;
+};
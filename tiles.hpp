@@ -0,0 +1,303 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+#include <vector>
+
+#include <GL/glew.h>
+#include <GLFW/glfw3.h>
+
+#include "log.hpp"
+#include "simd.hpp"
+#include "mesh.hpp"
+#include "shader.hpp"
+#include "renderer.hpp"
+#include "stream_buffer.hpp"
+
+#include "vendor/glm/glm.hpp"
+
+// The six planes of a clip matrix, pointing inwards, ax + by + cz + d >= 0 inside
+struct Frustum {
+	glm::vec4 planes[6];
+
+	Frustum(const glm::mat4& clip) {
+		// rows of the matrix, glm is column major
+		glm::vec4 x = glm::vec4(clip[0][0], clip[1][0], clip[2][0], clip[3][0]);
+		glm::vec4 y = glm::vec4(clip[0][1], clip[1][1], clip[2][1], clip[3][1]);
+		glm::vec4 z = glm::vec4(clip[0][2], clip[1][2], clip[2][2], clip[3][2]);
+		glm::vec4 w = glm::vec4(clip[0][3], clip[1][3], clip[2][3], clip[3][3]);
+
+		planes[0] = w + x;
+		planes[1] = w - x;
+		planes[2] = w + y;
+		planes[3] = w - y;
+		planes[4] = w + z;
+		planes[5] = w - z;
+	}
+};
+
+struct TilesConfig {
+	// tiles per side
+	int tiles = 128;
+	// cells per side of a tile
+	int cells = 8;
+	float spacing = 0.01f;
+};
+
+// The plane split in square tiles that share one index buffer. Tiles are culled
+// on the CPU against the frustum, in batches, and the ones left are drawn with a
+// single instanced call whose per instance attribute is the tile offset.
+//
+// The shader (plane.vert with TILED) adds the offset at location 1 to the local
+// position at location 0.
+struct Tiles {
+
+	Tiles(const TilesConfig& config, float wave_bound, SimdLevel level = simd_detect()) : config(config), simd(level) {
+		assert(config.tiles > 0 && config.cells > 0);
+
+		const size_t count = (size_t)config.tiles * config.tiles;
+
+		min_x.resize(count);
+		min_y.resize(count);
+		min_z.resize(count);
+		max_x.resize(count);
+		max_y.resize(count);
+		max_z.resize(count);
+
+		bound(wave_bound);
+
+		survivors.resize(count);
+		offsets.resize(2 * count);
+
+		build_mesh();
+	}
+
+	~Tiles() {
+		delete mesh;
+		delete stream;
+	}
+
+	// Keeps the tiles that intersect the frustum of the given clip matrix
+	void cull(const glm::mat4& mvp) {
+		Frustum frustum(mvp);
+
+		const size_t count = min_x.size();
+		size_t done = 0;
+		size_t kept = 0;
+
+#if SIMD_X86
+		if (simd == SimdLevel::AVX2)
+			done = cull_avx2(frustum, count, &kept);
+		else if (simd == SimdLevel::SSE)
+			done = cull_sse(frustum, count, &kept);
+#endif
+
+		cull_scalar(frustum, done, count, &kept);
+
+		// the boxes are padded, the offsets are the tile corners
+		const float size = config.cells * config.spacing;
+
+		for (size_t i = 0; i < kept; i++) {
+			offsets[2 * i] = (survivors[i] / config.tiles) * size;
+			offsets[2 * i + 1] = (survivors[i] % config.tiles) * size;
+		}
+
+		visible = kept;
+	}
+
+	// The waves move the surface up and down by at most wave_bound, and
+	// sideways by at most horizontal_bound, the choppy ocean does
+	void bound(float wave_bound, float horizontal_bound = 0.0f) {
+		const float size = config.cells * config.spacing;
+
+		for (int x = 0; x < config.tiles; x++) {
+			for (int z = 0; z < config.tiles; z++) {
+				size_t i = (size_t)x * config.tiles + z;
+
+				min_x[i] = x * size - horizontal_bound;
+				min_z[i] = z * size - horizontal_bound;
+				max_x[i] = (x + 1) * size + horizontal_bound;
+				max_z[i] = (z + 1) * size + horizontal_bound;
+			}
+		}
+
+		std::fill(min_y.begin(), min_y.end(), -wave_bound);
+		std::fill(max_y.begin(), max_y.end(), wave_bound);
+	}
+
+	// The offsets go into the next region of the stream buffer, the draw reads them from there
+	void render(Renderer* renderer, Shader* shader) {
+		void* target = stream->map();
+		memcpy(target, offsets.data(), visible * 2 * sizeof(float));
+		GLintptr offset = stream->unmap();
+
+		mesh->bind();
+		mesh->instance_offset(offset, visible);
+
+		renderer->render(mesh, shader);
+
+		stream->fence();
+	}
+
+	size_t tile_count() {
+		return min_x.size();
+	}
+
+	size_t visible_count() {
+		return visible;
+	}
+
+private:
+	void build_mesh() {
+		const int cells = config.cells;
+
+		std::vector<float> vertices;
+		std::vector<unsigned int> indices;
+
+		for (int x = 0; x < cells + 1; x++) {
+			for (int z = 0; z < cells + 1; z++) {
+				vertices.push_back(x * config.spacing);
+				vertices.push_back(0.0f);
+				vertices.push_back(z * config.spacing);
+			}
+		}
+
+		// same triangles as the whole plane in water.cpp
+		for (int x = 0; x < cells; x++) {
+			for (int z = 0; z < cells; z++) {
+				auto zero = x * (cells + 1) + z;
+				auto one = zero + 1;
+				auto two = (x + 1) * (cells + 1) + z;
+				auto three = two + 1;
+
+				indices.push_back(zero);
+				indices.push_back(one);
+				indices.push_back(three);
+
+				indices.push_back(zero);
+				indices.push_back(three);
+				indices.push_back(two);
+			}
+		}
+
+		mesh = new Mesh();
+		mesh->data(vertices.size() * sizeof(float), vertices.data(), GL_STATIC_DRAW);
+		mesh->attributes<float>(3, false, 3 * sizeof(float));
+		mesh->indices(indices.size() * sizeof(unsigned int), indices.data(), GL_STATIC_DRAW);
+		// room for every tile in each region
+		stream = new StreamBuffer(GL_ARRAY_BUFFER, offsets.size() * sizeof(float));
+
+		mesh->instance_buffer(stream->id());
+		mesh->instance_attributes<float>(2, false, 2 * sizeof(float));
+		mesh->mode(GL_TRIANGLES);
+	}
+
+	// The corner of the box furthest along the plane normal decides, the
+	// choice is the same for every box so it is made once per plane
+	struct Corner {
+		const float* x;
+		const float* y;
+		const float* z;
+	};
+
+	Corner corner(const glm::vec4& plane) {
+		return {
+			plane.x > 0.0f ? max_x.data() : min_x.data(),
+			plane.y > 0.0f ? max_y.data() : min_y.data(),
+			plane.z > 0.0f ? max_z.data() : min_z.data(),
+		};
+	}
+
+	void cull_scalar(const Frustum& frustum, size_t begin, size_t end, size_t* kept) {
+		Corner corners[6];
+
+		for (int p = 0; p < 6; p++)
+			corners[p] = corner(frustum.planes[p]);
+
+		for (size_t i = begin; i < end; i++) {
+			bool inside = true;
+
+			for (int p = 0; p < 6 && inside; p++) {
+				const glm::vec4& plane = frustum.planes[p];
+				inside = plane.x * corners[p].x[i] + plane.y * corners[p].y[i] + plane.z * corners[p].z[i] + plane.w >= 0.0f;
+			}
+
+			if (inside)
+				survivors[(*kept)++] = i;
+		}
+	}
+
+#if SIMD_X86
+	SIMD_TARGET_SSE size_t cull_sse(const Frustum& frustum, size_t count, size_t* kept) {
+		const size_t end = count & ~size_t(3);
+
+		Corner corners[6];
+
+		for (int p = 0; p < 6; p++)
+			corners[p] = corner(frustum.planes[p]);
+
+		for (size_t i = 0; i < end; i += 4) {
+			__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+			for (int p = 0; p < 6; p++) {
+				const glm::vec4& plane = frustum.planes[p];
+
+				__m128 d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.x), _mm_loadu_ps(corners[p].x + i)), _mm_set1_ps(plane.w));
+				d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.y), _mm_loadu_ps(corners[p].y + i)), d);
+				d = _mm_add_ps(_mm_mul_ps(_mm_set1_ps(plane.z), _mm_loadu_ps(corners[p].z + i)), d);
+
+				inside = _mm_and_ps(inside, _mm_cmpge_ps(d, _mm_setzero_ps()));
+			}
+
+			for (int mask = _mm_movemask_ps(inside); mask; mask &= mask - 1)
+				survivors[(*kept)++] = i + __builtin_ctz(mask);
+		}
+
+		return end;
+	}
+
+	SIMD_TARGET_AVX2 size_t cull_avx2(const Frustum& frustum, size_t count, size_t* kept) {
+		const size_t end = count & ~size_t(7);
+
+		Corner corners[6];
+
+		for (int p = 0; p < 6; p++)
+			corners[p] = corner(frustum.planes[p]);
+
+		for (size_t i = 0; i < end; i += 8) {
+			__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+			for (int p = 0; p < 6; p++) {
+				const glm::vec4& plane = frustum.planes[p];
+
+				__m256 d = _mm256_fmadd_ps(_mm256_set1_ps(plane.x), _mm256_loadu_ps(corners[p].x + i), _mm256_set1_ps(plane.w));
+				d = _mm256_fmadd_ps(_mm256_set1_ps(plane.y), _mm256_loadu_ps(corners[p].y + i), d);
+				d = _mm256_fmadd_ps(_mm256_set1_ps(plane.z), _mm256_loadu_ps(corners[p].z + i), d);
+
+				inside = _mm256_and_ps(inside, _mm256_cmp_ps(d, _mm256_setzero_ps(), _CMP_GE_OQ));
+			}
+
+			for (int mask = _mm256_movemask_ps(inside); mask; mask &= mask - 1)
+				survivors[(*kept)++] = i + __builtin_ctz(mask);
+		}
+
+		return end;
+	}
+#endif
+
+	TilesConfig config;
+	SimdLevel simd;
+
+	// bounding boxes, one array per coordinate
+	std::vector<float> min_x, min_y, min_z;
+	std::vector<float> max_x, max_y, max_z;
+
+	std::vector<uint32_t> survivors;
+	std::vector<float> offsets;
+	size_t visible = 0;
+
+	Mesh* mesh;
+	StreamBuffer* stream;
+};
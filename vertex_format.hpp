@@ -0,0 +1,148 @@
+#pragma once
+
+#include <algorithm>
+#include <cassert>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <initializer_list>
+#include <vector>
+
+#include <GL/glew.h>
+
+// Vertex data smaller than floats, and the CPU side that makes it. Integer
+// types go to the shader as floats, scaled to [0, 1] or [-1, 1] when
+// normalized, or as ints through Mesh::integer_attributes. The functions are
+// inline, not every user of the header needs every encoder.
+
+// IEEE half float, 10 bits of mantissa, good for values that need the range but not the precision
+struct Half {
+	uint16_t bits;
+};
+
+// x, y and z in 10 bits each and w in 2, the least significant bits first, one
+// attribute of 4 components in 4 bytes, for normals and tangents
+struct Packed2101010 {
+	uint32_t bits;
+};
+
+// OpenGL type and size of an attribute made of size Ts
+template<typename T> struct VertexType;
+
+template<> struct VertexType<float> { static constexpr GLenum type = GL_FLOAT; };
+template<> struct VertexType<int8_t> { static constexpr GLenum type = GL_BYTE; };
+template<> struct VertexType<uint8_t> { static constexpr GLenum type = GL_UNSIGNED_BYTE; };
+template<> struct VertexType<int16_t> { static constexpr GLenum type = GL_SHORT; };
+template<> struct VertexType<uint16_t> { static constexpr GLenum type = GL_UNSIGNED_SHORT; };
+template<> struct VertexType<int32_t> { static constexpr GLenum type = GL_INT; };
+template<> struct VertexType<uint32_t> { static constexpr GLenum type = GL_UNSIGNED_INT; };
+template<> struct VertexType<Half> { static constexpr GLenum type = GL_HALF_FLOAT; };
+template<> struct VertexType<Packed2101010> { static constexpr GLenum type = GL_INT_2_10_10_10_REV; };
+
+// Bytes an attribute of size components takes
+template<typename T>
+inline size_t attribute_bytes(GLint size) {
+	return size * sizeof(T);
+}
+
+// all four components are in the one word, whatever size says
+template<>
+inline size_t attribute_bytes<Packed2101010>(GLint) {
+	return sizeof(Packed2101010);
+}
+
+// Rounds to the nearest half, out of range goes to infinity, NaN stays NaN
+inline Half to_half(float value) {
+	uint32_t bits;
+	memcpy(&bits, &value, sizeof(bits));
+
+	const uint32_t sign = (bits >> 16) & 0x8000;
+	const int exponent = (int)((bits >> 23) & 0xff) - 127 + 15;
+	uint32_t mantissa = bits & 0x7fffff;
+
+	if (((bits >> 23) & 0xff) == 0xff)
+		return {(uint16_t)(sign | 0x7c00 | (mantissa ? 0x200 : 0))};
+
+	if (exponent >= 31)
+		return {(uint16_t)(sign | 0x7c00)};
+
+	// too small for a normal half, the implicit one goes into the mantissa
+	if (exponent <= 0) {
+		if (exponent < -10)
+			return {(uint16_t)sign};
+
+		mantissa |= 0x800000;
+		const int shift = 14 - exponent;
+		const uint32_t half = mantissa >> shift;
+		const uint32_t rest = mantissa & ((1u << shift) - 1);
+		const uint32_t midpoint = 1u << (shift - 1);
+
+		return {(uint16_t)(sign | (half + (rest > midpoint || (rest == midpoint && (half & 1)))))};
+	}
+
+	const uint32_t half = sign | (uint32_t)exponent << 10 | mantissa >> 13;
+	const uint32_t rest = mantissa & 0x1fff;
+
+	// a carry out of the mantissa moves the exponent up, which is still right
+	return {(uint16_t)(half + (rest > 0x1000 || (rest == 0x1000 && (half & 1))))};
+}
+
+inline float from_half(Half value) {
+	const uint32_t sign = (uint32_t)(value.bits & 0x8000) << 16;
+	const uint32_t exponent = (value.bits >> 10) & 0x1f;
+	const uint32_t mantissa = value.bits & 0x3ff;
+
+	if (exponent == 0) {
+		const float magnitude = std::ldexp((float)mantissa, -24);
+		return sign ? -magnitude : magnitude;
+	}
+
+	uint32_t bits = sign | (exponent == 31 ? 0x7f800000 | mantissa << 13 : (exponent + 127 - 15) << 23 | mantissa << 13);
+
+	float result;
+	memcpy(&result, &bits, sizeof(result));
+
+	return result;
+}
+
+// [0, 1] into the whole unsigned short range
+inline uint16_t to_unorm16(float value) {
+	return (uint16_t)std::lround(std::clamp(value, 0.0f, 1.0f) * 65535.0f);
+}
+
+// [-1, 1] into a short, both ends exact, the way OpenGL 4.2 reads them back
+inline int16_t to_snorm16(float value) {
+	return (int16_t)std::lround(std::clamp(value, -1.0f, 1.0f) * 32767.0f);
+}
+
+// Each of x, y, z in [-1, 1] and w in {-1, 0, 1}, normalized signed components
+inline Packed2101010 to_snorm2101010(float x, float y, float z, float w = 0.0f) {
+	auto component = [](float value, int bits) {
+		const int maximum = (1 << (bits - 1)) - 1;
+		return (uint32_t)std::lround(std::clamp(value, -1.0f, 1.0f) * maximum) & ((1u << bits) - 1);
+	};
+
+	return {component(x, 10) | component(y, 10) << 10 | component(z, 10) << 20 | component(w, 2) << 30};
+}
+
+// Vertices that sit on a grid of spacing, as whole steps from the origin.
+// components picks the floats of each vertex that are kept, in order, stride
+// is in floats. Every kept value has to be on the grid and fit in 16 bits.
+inline std::vector<uint16_t> quantize_grid(const float* vertices, size_t count, size_t stride, float spacing, std::initializer_list<int> components) {
+	std::vector<uint16_t> result;
+	result.reserve(count * components.size());
+
+	for (size_t v = 0; v < count; v++) {
+		for (int component : components) {
+			const float steps = vertices[v * stride + component] / spacing;
+			const long step = std::lround(steps);
+
+			assert(step >= 0 && step <= 0xffff && "Vertex outside the quantized grid");
+			assert(std::abs(steps - step) < 1e-3f && "Vertex not on the grid");
+
+			result.push_back((uint16_t)std::clamp(step, 0l, 0xffffl));
+		}
+	}
+
+	return result;
+}
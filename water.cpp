@@ -1,5 +1,10 @@
 #include <assert.h>
 #include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <string>
+#include <vector>
 
 #include <GL/glew.h>
 #include <GLFW/glfw3.h>
@@ -9,6 +14,15 @@
 #include "mesh.hpp"
 #include "texture.hpp"
 #include "renderer.hpp"
+#include "clipmap.hpp"
+#include "tiles.hpp"
+#include "waves.hpp"
+#include "ocean.hpp"
+#include "heightfield.hpp"
+#include "profiler.hpp"
+#include "plane.hpp"
+#include "job_system.hpp"
+#include "file_watch.hpp"
 
 #include "vendor/glm/glm.hpp"
 #include "vendor/glm/gtc/matrix_transform.hpp"
@@ -17,82 +31,222 @@
 #include "vendor/imgui/imgui_impl_glfw.h"
 #include "vendor/imgui/imgui_impl_opengl3.h"
 
-static void fps(GLFWwindow* window) {
-	static double previous_seconds = glfwGetTime();
-	static int frame_count;
+enum class PlaneMode {
+	INDEXED,
+	STRIPS,
+	ATTRIBUTELESS,
+	CLIPMAP,
+	TESSELLATED,
+	TILED,
+};
+
+// Uniform block binding points
+const GLuint WAVES_BINDING = 0;
+
+// Draw order of the command queue
+enum Pass : uint8_t {
+	PASS_OPAQUE,
+	PASS_TRANSPARENT,
+};
+
+struct Options {
+	PlaneMode plane = PlaneMode::INDEXED;
+	// cells per side, only the attributeless plane can change it
+	int grid = SIZE;
+	ClipmapConfig clipmap;
+	// patches per side and on screen triangle edge length of the tessellated plane
+	int patches = 64;
+	float edge_pixels = 8.0f;
+	TilesConfig tiles;
+	// the sum of sines
+	WaveParams waves;
+	// FFT ocean instead of the sum of sines
+	bool ocean = false;
+	OceanConfig spectrum;
+	// simulated water added on top, over the whole plane
+	bool heightfield = false;
+	HeightfieldConfig simulation;
+	// offscreen with no display, for a fixed number of frames if not zero
+	bool headless = false;
+	size_t frames = 0;
+	// file to record into, the format goes by the extension
+	const char* capture = nullptr;
+	// Chrome trace of the whole run, written on exit
+	const char* trace = nullptr;
+	// linked programs are kept under this directory, the user cache when null
+	bool shader_cache = true;
+	const char* shader_cache_root = nullptr;
+};
+
+static Options parse_options(int argc, char** argv) {
+	Options options;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strcmp(argv[i], "--plane") && i + 1 < argc) {
+			const char* mode = argv[++i];
+
+			if (!strcmp(mode, "indexed"))
+				options.plane = PlaneMode::INDEXED;
+			else if (!strcmp(mode, "strips"))
+				options.plane = PlaneMode::STRIPS;
+			else if (!strcmp(mode, "attributeless"))
+				options.plane = PlaneMode::ATTRIBUTELESS;
+			else if (!strcmp(mode, "clipmap"))
+				options.plane = PlaneMode::CLIPMAP;
+			else if (!strcmp(mode, "tessellated"))
+				options.plane = PlaneMode::TESSELLATED;
+			else if (!strcmp(mode, "tiled"))
+				options.plane = PlaneMode::TILED;
+			else
+				fprintf(stderr, "unknown plane mode: %s\n", mode);
+
+		} else if (!strcmp(argv[i], "--grid") && i + 1 < argc) {
+			options.grid = atoi(argv[++i]);
+
+		} else if (!strcmp(argv[i], "--levels") && i + 1 < argc) {
+			options.clipmap.levels = atoi(argv[++i]);
+
+		} else if (!strcmp(argv[i], "--level-size") && i + 1 < argc) {
+			options.clipmap.size = atoi(argv[++i]);
+
+		} else if (!strcmp(argv[i], "--patches") && i + 1 < argc) {
+			options.patches = atoi(argv[++i]);
+
+		} else if (!strcmp(argv[i], "--edge-pixels") && i + 1 < argc) {
+			options.edge_pixels = atof(argv[++i]);
+
+		} else if (!strcmp(argv[i], "--tiles") && i + 1 < argc) {
+			options.tiles.tiles = atoi(argv[++i]);
+
+		} else if (!strcmp(argv[i], "--tile-cells") && i + 1 < argc) {
+			options.tiles.cells = atoi(argv[++i]);
+
+		} else if (!strcmp(argv[i], "--waves") && i + 1 < argc) {
+			options.waves.iterations = atoi(argv[++i]);
+
+		} else if (!strcmp(argv[i], "--wave-spread") && i + 1 < argc) {
+			options.waves.spread = atof(argv[++i]);
+
+		} else if (!strcmp(argv[i], "--ocean")) {
+			options.ocean = true;
+
+		} else if (!strcmp(argv[i], "--spectrum") && i + 1 < argc) {
+			const char* spectrum = argv[++i];
+
+			if (!strcmp(spectrum, "phillips"))
+				options.spectrum.spectrum = Spectrum::PHILLIPS;
+			else if (!strcmp(spectrum, "jonswap"))
+				options.spectrum.spectrum = Spectrum::JONSWAP;
+			else
+				fprintf(stderr, "unknown spectrum: %s\n", spectrum);
+
+		} else if (!strcmp(argv[i], "--ocean-size") && i + 1 < argc) {
+			options.spectrum.size = atoi(argv[++i]);
+
+		} else if (!strcmp(argv[i], "--wind") && i + 1 < argc) {
+			options.spectrum.wind_speed = atof(argv[++i]);
+
+		} else if (!strcmp(argv[i], "--heightfield")) {
+			options.heightfield = true;
+
+		} else if (!strcmp(argv[i], "--heightfield-size") && i + 1 < argc) {
+			options.simulation.size = atoi(argv[++i]);
+
+		} else if (!strcmp(argv[i], "--headless")) {
+			options.headless = true;
+
+		} else if (!strcmp(argv[i], "--frames") && i + 1 < argc) {
+			options.frames = strtoul(argv[++i], nullptr, 10);
+
+		} else if (!strcmp(argv[i], "--capture") && i + 1 < argc) {
+			options.capture = argv[++i];
+
+		} else if (!strcmp(argv[i], "--trace") && i + 1 < argc) {
+			options.trace = argv[++i];
+
+		} else if (!strcmp(argv[i], "--shader-cache") && i + 1 < argc) {
+			options.shader_cache_root = argv[++i];
 
-	double current_seconds = glfwGetTime();
-	double elapsed_seconds = current_seconds - previous_seconds;
+		} else if (!strcmp(argv[i], "--no-shader-cache")) {
+			options.shader_cache = false;
 
-	if (elapsed_seconds > 0.25) {
-		previous_seconds = current_seconds;
+		} else {
+			fprintf(stderr, "unknown option: %s\n", argv[i]);
+		}
+	}
 
-		double fps = (double)frame_count / elapsed_seconds;
-		char tmp[128];
-		sprintf(tmp, "opengl @ fps: %.2f", fps);
-		GL_CALL(glfwSetWindowTitle(window, tmp));
+	if (options.grid < 1)
+		options.grid = SIZE;
 
-		frame_count = 0;
-	}
+	if (options.patches < 1)
+		options.patches = Options().patches;
+
+	if (options.edge_pixels <= 0.0f)
+		options.edge_pixels = Options().edge_pixels;
+
+	if (options.tiles.tiles < 1)
+		options.tiles.tiles = TilesConfig().tiles;
+
+	if (options.tiles.cells < 1)
+		options.tiles.cells = TilesConfig().cells;
+
+	if (options.waves.iterations < 0 || options.waves.iterations > MAX_WAVES)
+		options.waves.iterations = WaveParams().iterations;
+
+	if (options.clipmap.levels < 1)
+		options.clipmap.levels = ClipmapConfig().levels;
+
+	if (options.clipmap.size < 8 || options.clipmap.size % 4)
+		options.clipmap.size = ClipmapConfig().size;
+
+	// the FFT needs a power of two no smaller than its column blocks
+	if (options.spectrum.size < (int)FFT2D::BLOCK || options.spectrum.size & (options.spectrum.size - 1))
+		options.spectrum.size = OceanConfig().size;
+
+	if (options.spectrum.wind_speed <= 0.0f)
+		options.spectrum.wind_speed = OceanConfig().wind_speed;
+
+	if (options.simulation.size < 3)
+		options.simulation.size = HeightfieldConfig().size;
 
-	frame_count++;
+	options.simulation.length = SIZE * SPACING;
+
+	return options;
 }
 
-const int SIZE = 1000;
+// .y4m video, .ppm image sequence numbered at a %d in the path, raw rgb24 otherwise
+static CaptureFormat capture_format(const char* path) {
+	const char* extension = strrchr(path, '.');
+
+	if (extension && !strcmp(extension, ".y4m"))
+		return CaptureFormat::Y4M;
 
-const int VERTEX_SIZE = 3;
+	if (extension && !strcmp(extension, ".ppm"))
+		return CaptureFormat::PPM;
 
-float tesselated_plane[VERTEX_SIZE * (SIZE + 1) * (SIZE + 1)];
-unsigned int tesselated_plane_indices[6 * SIZE * SIZE];
+	return CaptureFormat::RAW;
+}
 
-int main() {
+int main(int argc, char** argv) {
 	const char* GLSL_VERSION = "#version 400";
 
-	const float Y = 0.0f;
+	Options options = parse_options(argc, argv);
 
-	int p = 0;
-	for (int x = 0; x < SIZE + 1; x++) {
-		for (int z = 0; z < SIZE + 1; z++) {
-			tesselated_plane[p++] = x;
-			tesselated_plane[p++] = Y;
-			tesselated_plane[p++] = z;
-		}
-	}
+	Renderer* renderer = new Renderer(640, 480, "water");
 
-	int i = 0;
-	for (int x = 0; x < SIZE; x++) {
-		for (int z = 0; z < SIZE; z++) {
-			auto zero = x * (SIZE + 1) + z;
-			auto one = zero + 1;
-			auto two = (x + 1) * (SIZE + 1) + z;
-			auto three = two + 1;
-
-			/**
-			 * .---.
-			 * | /
-			 * .
-			 */
-			tesselated_plane_indices[i++] = zero;
-			tesselated_plane_indices[i++] = one;
-			tesselated_plane_indices[i++] = three;
-
-			/**
-			 *     .
-			 *   / |
-			 * .---.
-			 */
-			tesselated_plane_indices[i++] = zero;
-			tesselated_plane_indices[i++] = three;
-			tesselated_plane_indices[i++] = two;
-		}
+	bool started = options.headless ? renderer->start_headless(options.frames) : renderer->start_window();
+
+	if (!started) {
+		fprintf(stderr, "could not start the renderer, see %s\n", GL_LOG_FILE);
+		return 1;
 	}
 
-	for (int i = 0; i < sizeof(tesselated_plane) / sizeof(float); i++)
-		tesselated_plane[i] *= 0.01f;
+	GLFWwindow* window = options.headless ? nullptr : renderer->get_window();
 
-	Renderer* renderer = new Renderer(640, 480, "water");
-	renderer->start_window();
-	GLFWwindow* window = renderer->get_window();
+	if (options.shader_cache)
+		Shader::cache = new ProgramCache(options.shader_cache_root);
+
+	Shader::parallel_compile();
 
 	// Setup Dear ImGui context
 	IMGUI_CHECKVERSION();
@@ -106,22 +260,115 @@ int main() {
 	//ImGui::StyleColorsLight();
 
 	// Setup Platform/Renderer backends
-	ImGui_ImplGlfw_InitForOpenGL(window, true);
+	if (window)
+		ImGui_ImplGlfw_InitForOpenGL(window, true);
 	ImGui_ImplOpenGL3_Init(GLSL_VERSION);
 
 	renderer->blend();
 
 	Mesh* plane = new Mesh();
-	plane->data(sizeof(tesselated_plane), tesselated_plane, GL_STATIC_DRAW);
-	plane->attributes<float>(3, false, VERTEX_SIZE * sizeof(float));
-	plane->indices(sizeof(tesselated_plane_indices), tesselated_plane_indices, GL_STATIC_DRAW);
-	plane->mode(GL_TRIANGLES);
+	Shader* shader;
+	Clipmap* clipmap = nullptr;
+	Tiles* tiles = nullptr;
+
+	JobSystem* jobs = new JobSystem();
+	Ocean* ocean = nullptr;
+	Texture* displacement = nullptr;
+	Texture* normals = nullptr;
+	Heightfield* heightfield = nullptr;
+	Texture* heights = nullptr;
+
+	// how far the surface moves from the plane, for culling
+	Waves waves(options.waves);
+	float surface_bound = waves.bound();
+	// the sines only move it up and down
+	float horizontal_bound = 0.0f;
+
+	// every program reads the waves from the same buffer
+	UniformBuffer<WaveBlock>* wave_buffer = new UniformBuffer<WaveBlock>(WAVES_BINDING, waves.block());
+
+	if (options.ocean) {
+		ocean = new Ocean(options.spectrum, jobs);
+
+		const int size = ocean->size();
+		displacement = new Texture(size, size, GL_RGBA32F, GL_RGBA, GL_FLOAT);
+		normals = new Texture(size, size, GL_RGBA32F, GL_RGBA, GL_FLOAT);
+
+		// the spectrum is random, leave room for taller waves than the first ones
+		ocean->update(0.0f);
+		surface_bound = 2.0f * ocean->bound();
+		// the bound covers every component of the displacement, the choppy x and z too
+		horizontal_bound = surface_bound;
+	}
+
+	if (options.heightfield) {
+		heightfield = new Heightfield(options.simulation, jobs);
 
-	Shader* shader = new Shader("plane.vert", "plane.frag");
+		const int size = heightfield->size();
+		heights = new Texture(size, size, GL_R32F, GL_RED, GL_FLOAT, GL_CLAMP_TO_EDGE);
+	}
+
+	// the shader keeps a pointer to its defines to reload
+	std::string defines = options.ocean ? "#define OCEAN\n" : waves.define();
+
+	if (options.heightfield)
+		defines += "#define HEIGHTFIELD\n";
+
+	if (options.plane == PlaneMode::ATTRIBUTELESS) {
+		plane->grid(options.grid, options.grid);
+		defines += "#define ATTRIBUTELESS\n";
+		shader = new Shader("plane.vert", "plane.frag", defines.c_str());
+
+	} else if (options.plane == PlaneMode::CLIPMAP) {
+		defines += "#define ATTRIBUTELESS\n#define CLIPMAP\n";
+		shader = new Shader("plane.vert", "plane.frag", defines.c_str());
+		clipmap = new Clipmap(options.clipmap, shader);
+
+	} else if (options.plane == PlaneMode::TESSELLATED) {
+		generate_patches(plane, options.patches);
+		defines += "#define TESSELLATED\n";
+		shader = new Shader("plane.vert", "plane.tesc", "plane.tese", "plane.frag", defines.c_str());
+
+	} else if (options.plane == PlaneMode::TILED) {
+		tiles = new Tiles(options.tiles, surface_bound);
+		tiles->bound(surface_bound, horizontal_bound);
+		defines += "#define TILED\n";
+		shader = new Shader("plane.vert", "plane.frag", defines.c_str());
+
+	} else if (options.plane == PlaneMode::STRIPS) {
+		upload_plane_strips(plane);
+
+		defines += "#define QUANTIZED\n";
+		shader = new Shader("plane.vert", "plane.frag", defines.c_str());
+
+	} else {
+		if (!upload_plane(plane, jobs)) {
+			fprintf(stderr, "could not build the plane, see %s\n", GL_LOG_FILE);
+			return 1;
+		}
+
+		defines += "#define QUANTIZED\n";
+		shader = new Shader("plane.vert", "plane.frag", defines.c_str());
+	}
+
+	shader->uniform_block("Waves", WAVES_BINDING);
 
 	Location1F utime = shader->uniform1f("time");
 	utime.set(0.0f);
 
+	Location1F uspacing = shader->uniform1f("spacing");
+	Location1F upixels_per_unit = shader->uniform1f("pixels_per_unit");
+	Location1F uedge_pixels = shader->uniform1f("edge_pixels");
+
+	Location1I uocean_displacement = shader->uniform1i("ocean_displacement");
+	Location1I uocean_normals = shader->uniform1i("ocean_normals");
+	Location1F uocean_length = shader->uniform1f("ocean_length");
+	Location1F uocean_bound = shader->uniform1f("ocean_bound");
+
+	Location1I uheightfield = shader->uniform1i("heightfield");
+	Location3F uheightfield_area = shader->uniform3f("heightfield_area");
+	Location1F uheightfield_bound = shader->uniform1f("heightfield_bound");
+
 	glm::vec3 translation(-1.0f, 0.0f, 0.0f);
 
 	glm::mat4 projection = glm::perspective(glm::radians(45.0f), 640.0f / 480.0f, 1.0f, 1000.0f);
@@ -132,9 +379,36 @@ int main() {
 
 	renderer->culling(true, GL_BACK, GL_CCW);
 
+	CommandQueue* queue = new CommandQueue();
+
+	// saving a shader file rebuilds the program in the background
+	FileWatch* watch = new FileWatch();
+
+	for (const std::string& file : shader->files())
+		watch->add(file);
+
+	Profiler* profiler = new Profiler();
+	profiler->trace(options.trace != nullptr);
+
+	Capture* capture = nullptr;
+
+	if (options.capture) {
+		capture = new Capture(options.capture, Renderer::window_width, Renderer::window_height, capture_format(options.capture));
+		renderer->record(capture);
+	}
+
+	// the simulation step of the next frame, it runs while this one draws
+	JobCounter simulating;
+
+	// R reloads when it goes down, holding it would restart the build every frame
+	bool reload_key = false;
+
 	while (!renderer->window_should_close()) {
 
-		fps(window);
+		profiler->begin_frame();
+
+		// GL work the jobs left for this thread
+		jobs->run_main();
 
 		renderer->clear();
 
@@ -142,25 +416,184 @@ int main() {
 		glm::mat4 mvp = projection * rotateDownward * view * model;
 		umvp.set(&mvp);
 
-		renderer->render(plane, shader);
+		// same extent as the indexed plane, whatever the resolution
+		if (options.plane == PlaneMode::ATTRIBUTELESS)
+			uspacing.set(SIZE * SPACING / options.grid);
+
+		if (options.plane == PlaneMode::INDEXED || options.plane == PlaneMode::STRIPS)
+			uspacing.set(SPACING);
+
+		if (options.plane == PlaneMode::TESSELLATED) {
+			upixels_per_unit.set(projection[1][1] * Renderer::window_height * 0.5f);
+			uedge_pixels.set(options.edge_pixels);
+		}
+
+		wave_buffer->upload();
+
+		if (ocean || heightfield) {
+			ProfileScope scope(profiler, "simulation");
+			jobs->wait(simulating);
+		}
+
+		if (ocean) {
+			ProfileScope scope(profiler, "ocean");
+
+			displacement->update(ocean->displacement.data());
+			normals->update(ocean->normals.data());
+			displacement->bind(0);
+			normals->bind(1);
+
+			uocean_displacement.set(0);
+			uocean_normals.set(1);
+			uocean_length.set(ocean->length());
+			uocean_bound.set(surface_bound);
+		}
+
+		if (heightfield) {
+			heights->update(heightfield->heights());
+			heights->bind(2);
+
+			uheightfield.set(2);
+			uheightfield_area.set(glm::vec3(heightfield->origin(), heightfield->length()));
+			uheightfield_bound.set(heightfield->bound());
+
+			if (tiles)
+				tiles->bound(surface_bound + heightfield->bound(), horizontal_bound);
+
+			// something going round in circles leaves a wake, space drops a stone
+			float angle = 0.5f * utime.get();
+			glm::vec2 center = heightfield->origin() + 0.5f * heightfield->length();
+			heightfield->disturb(center + 2.5f * glm::vec2(cos(angle), sin(angle)), 0.1f, 0.002f);
+
+			if (renderer->pressed(GLFW_KEY_SPACE)) {
+				glm::vec2 drop = glm::vec2(rand(), rand()) / (float)RAND_MAX;
+				heightfield->disturb(heightfield->origin() + drop * heightfield->length(), 0.2f, 0.05f);
+			}
+		}
+
+		// the ocean is exact for the next frame's time, the heightfield shows
+		// this frame's disturbances one frame later
+		if (ocean || heightfield) {
+			const float next = utime.get() + 1.0f / 60.0f;
+
+			jobs->run([ocean, heightfield, next] {
+				if (ocean)
+					ocean->update(next);
+
+				if (heightfield)
+					heightfield->update(1.0f / 60.0f);
+			}, &simulating);
+		}
+
+		if (clipmap) {
+			// the camera, in plane coordinates
+			glm::vec4 eye = glm::inverse(rotateDownward * view * model) * glm::vec4(0.0f, 0.0f, 0.0f, 1.0f);
+
+			clipmap->update(glm::vec2(eye.x, eye.z));
+
+			GpuScope gpu(profiler, "plane");
+			clipmap->render(renderer, shader);
+
+		} else if (tiles) {
+			{
+				ProfileScope scope(profiler, "cull");
+				tiles->cull(mvp);
+			}
+
+			GpuScope gpu(profiler, "plane");
+			tiles->render(renderer, shader);
+
+		} else {
+			GpuScope gpu(profiler, "plane");
+			queue->list().draw(PASS_OPAQUE, plane, shader);
+			renderer->submit(queue);
+		}
+
+		if (window) {
+			GpuScope gpu(profiler, "overlay");
+
+			ImGui_ImplOpenGL3_NewFrame();
+			ImGui_ImplGlfw_NewFrame();
+			ImGui::NewFrame();
+
+			profiler->overlay();
+
+			ImGui::Render();
+			ImGui_ImplOpenGL3_RenderDrawData(ImGui::GetDrawData());
+		}
 
 		utime.set(utime.get() + 1.0f / 60.0f);
 
-		renderer->swap_buffers();
+		{
+			ProfileScope scope(profiler, "swap");
+			renderer->swap_buffers();
+		}
+
 		renderer->poll_events();
 
+		profiler->end_frame();
+
 		if (renderer->pressed(GLFW_KEY_ESCAPE))
 			renderer->close_window();
 
-		if (renderer->pressed(GLFW_KEY_R))
-			shader->reload();
+		std::vector<std::string> changes = watch->changes();
+
+		for (const std::string& file : changes)
+			gl_log("%s changed, reloading\n", file.c_str());
+
+		const bool reload_pressed = renderer->pressed(GLFW_KEY_R) == GLFW_PRESS;
+
+		if (!changes.empty() || (reload_pressed && !reload_key))
+			shader->reload_async();
+
+		reload_key = reload_pressed;
+
+		// the new program may include other files
+		if (shader->update()) {
+			for (const std::string& file : shader->files())
+				watch->add(file);
+		}
 	}
 
+	jobs->wait(simulating);
+	jobs->log_stats();
+
+	renderer->record(nullptr);
+	delete capture;
+
+	if (options.trace)
+		profiler->dump(options.trace);
+
+	delete profiler;
+
+	gl_call_report();
+
+	RenderState& state = renderer->render_state();
+	gl_log("render state: %zu binds, %zu skipped\n", state.binds(), state.skips());
+
+	if (Shader::cache)
+		gl_log("program cache: %zu hits, %zu misses\n", Shader::cache->hits(), Shader::cache->misses());
+
+	delete watch;
+	delete queue;
+	delete clipmap;
+	delete tiles;
+	delete displacement;
+	delete normals;
+	delete ocean;
+	delete heights;
+	delete heightfield;
+	delete jobs;
+	delete wave_buffer;
 	delete plane;
 	delete shader;
+	delete Shader::cache;
 	delete renderer;
 
 	ImGui_ImplOpenGL3_Shutdown();
-	ImGui_ImplGlfw_Shutdown();
+
+	if (window)
+		ImGui_ImplGlfw_Shutdown();
+
 	ImGui::DestroyContext();
 }
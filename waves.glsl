@@ -0,0 +1,133 @@
+// Displacement of the plane, shared by the stages that move it. The sum of
+// sines needs a time uniform and the Waves block, with OCEAN the FFT ocean maps
+// are sampled instead. With HEIGHTFIELD the simulated heights are added on top of either.
+
+#ifdef OCEAN
+uniform sampler2D ocean_displacement;
+uniform sampler2D ocean_normals;
+// side of the tileable patch covered by the maps
+uniform float ocean_length;
+// largest displacement in the maps
+uniform float ocean_bound;
+
+vec3 swell(vec2 position, out vec3 normal) {
+	vec2 uv = position / ocean_length;
+
+	normal = normalize(textureLod(ocean_normals, uv, 0.0).xyz);
+
+	return textureLod(ocean_displacement, uv, 0.0).xyz;
+}
+
+float swell_bound() {
+	return ocean_bound;
+}
+
+// the choppy maps move points sideways too, ocean_bound covers every component
+float swell_horizontal_bound() {
+	return ocean_bound;
+}
+#else
+#define MAX_WAVES 32
+
+// one term of the sum, direction is not normalized
+struct Wave {
+	float amplitude;
+	float frequency;
+	float speed;
+	vec2 direction;
+};
+
+// filled on the CPU from Waves, see WaveBlock in waves.hpp
+layout(std140) uniform Waves {
+	Wave waves[MAX_WAVES];
+	int wave_count;
+	// largest displacement sines() can return
+	float wave_bound;
+};
+
+// programs built for a known number of waves get it as a constant, the loop
+// unrolls then, with the uniform bound it is several times slower on llvmpipe
+#ifndef WAVE_COUNT
+#define WAVE_COUNT wave_count
+#endif
+
+// sum of sines, gradient is the derivative along x and z
+float sines(vec2 position, out vec2 gradient) {
+	float dy = 0.0;
+
+	gradient = vec2(0.0);
+
+	for (int i = 0; i < WAVE_COUNT; i++) {
+		float phase = waves[i].frequency * dot(waves[i].direction, position) + waves[i].speed * time;
+
+		dy += waves[i].amplitude * sin(phase);
+		gradient += waves[i].amplitude * waves[i].frequency * cos(phase) * waves[i].direction;
+	}
+
+	return dy;
+}
+
+vec3 swell(vec2 position, out vec3 normal) {
+	vec2 gradient;
+	float dy = sines(position, gradient);
+
+	vec3 partialDerivativeX = vec3(1.0, gradient.x, 0.0);
+	vec3 partialDerivativeZ = vec3(0.0, gradient.y, 1.0);
+
+	normal = normalize(cross(partialDerivativeZ, partialDerivativeX));
+
+	return vec3(0.0, dy, 0.0);
+}
+
+float swell_bound() {
+	return wave_bound;
+}
+
+float swell_horizontal_bound() {
+	return 0.0;
+}
+#endif
+
+#ifdef HEIGHTFIELD
+uniform sampler2D heightfield;
+// corner of the simulated square and its side
+uniform vec3 heightfield_area;
+// largest simulated height
+uniform float heightfield_bound;
+#endif
+
+vec3 surface(vec2 position, out vec3 normal) {
+	vec3 displacement = swell(position, normal);
+
+#ifdef HEIGHTFIELD
+	// the border of the simulation is flat, clamping gives nothing outside
+	vec2 uv = (position - heightfield_area.xy) / heightfield_area.z;
+	vec2 texel = 1.0 / vec2(textureSize(heightfield, 0));
+
+	float left = textureLod(heightfield, uv - vec2(texel.x, 0.0), 0.0).r;
+	float right = textureLod(heightfield, uv + vec2(texel.x, 0.0), 0.0).r;
+	float back = textureLod(heightfield, uv - vec2(0.0, texel.y), 0.0).r;
+	float front = textureLod(heightfield, uv + vec2(0.0, texel.y), 0.0).r;
+
+	vec2 slope = vec2(right - left, front - back) / (2.0 * texel * heightfield_area.z);
+
+	// slopes add up, the swell normal is (-dx, 1, -dz) once scaled
+	normal = normalize(normal / normal.y - vec3(slope.x, 0.0, slope.y));
+	displacement.y += textureLod(heightfield, uv, 0.0).r;
+#endif
+
+	return displacement;
+}
+
+float surface_bound() {
+#ifdef HEIGHTFIELD
+	return swell_bound() + heightfield_bound;
+#else
+	return swell_bound();
+#endif
+}
+
+// the heightfield only moves the surface up and down
+float surface_horizontal_bound() {
+	return swell_horizontal_bound();
+}
@@ -0,0 +1,331 @@
+#pragma once
+
+#include <cassert>
+#include <cmath>
+#include <cstddef>
+#include <string>
+#include <vector>
+
+#include "simd.hpp"
+
+// Waves in the uniform block of waves.glsl, the array has room for this many
+static constexpr int MAX_WAVES = 32;
+
+// A series of waves, each smaller and faster than the one before
+struct WaveParams {
+	float amplitude = 0.1f;
+	float frequency = 10.0f;
+	float speed = 1.0f;
+	float amplitude_decay = 0.82f;
+	float frequency_growth = 1.18f;
+	int iterations = 2;
+	// radians each wave turns from the previous one, all go along (1, 1) at zero
+	float spread = 0.0f;
+};
+
+// The Waves uniform block of waves.glsl, std140: every Wave takes two vec4s
+struct WaveBlock {
+	struct Wave {
+		float amplitude;
+		float frequency;
+		float speed;
+		float padding;
+		float dx, dz;
+		float padding2[2];
+	};
+
+	Wave waves[MAX_WAVES];
+	int count;
+	float bound;
+	// blocks are a whole number of vec4s
+	float padding[2];
+};
+
+// CPU side evaluation of the water surface, in plane (pre model matrix) coordinates.
+struct Waves {
+
+	// One term of the sum, travelling along (dx, dz)
+	struct Component {
+		float amplitude;
+		float frequency;
+		float speed;
+		float dx, dz;
+	};
+
+	Waves(const WaveParams& params = WaveParams(), SimdLevel level = simd_detect()) : simd(level) {
+		assert(params.iterations <= MAX_WAVES);
+
+		float amplitude = params.amplitude;
+		float frequency = params.frequency;
+
+		for (int i = 0; i < params.iterations; i++) {
+			// not normalized, frequencies are along x + z like they always were
+			float angle = i * params.spread;
+			float dx = std::cos(angle) - std::sin(angle);
+			float dz = std::sin(angle) + std::cos(angle);
+
+			components.push_back({amplitude, frequency, params.speed, dx, dz});
+
+			amplitude *= params.amplitude_decay;
+			frequency *= params.frequency_growth;
+		}
+	}
+
+	SimdLevel level() {
+		return simd;
+	}
+
+	// Largest displacement the surface can reach, for bounding volumes
+	float bound() {
+		float sum = 0.0f;
+
+		for (const Component& c : components)
+			sum += std::fabs(c.amplitude);
+
+		return sum;
+	}
+
+	// Fixes the number of waves in a program built with it, see waves.glsl,
+	// the block still has to hold the same waves
+	std::string define() {
+		return "#define WAVE_COUNT " + std::to_string(components.size()) + "\n";
+	}
+
+	// The same waves for the shaders
+	WaveBlock block() {
+		WaveBlock block = {};
+
+		for (size_t i = 0; i < components.size(); i++) {
+			const Component& c = components[i];
+			block.waves[i] = {c.amplitude, c.frequency, c.speed, 0.0f, c.dx, c.dz, {}};
+		}
+
+		block.count = components.size();
+		block.bound = bound();
+
+		return block;
+	}
+
+	float height(float x, float z, float time) {
+		float y;
+		evaluate(1, &x, &z, time, &y, nullptr, nullptr, nullptr);
+		return y;
+	}
+
+	// Heights and unit normals for count points, normals are optional (all null or none)
+	void evaluate(size_t count, const float* x, const float* z, float time, float* height, float* nx, float* ny, float* nz) {
+		assert((nx && ny && nz) || (!nx && !ny && !nz));
+
+		size_t done = 0;
+
+#if SIMD_X86
+		if (simd == SimdLevel::AVX2)
+			done = waves_avx2(components.data(), components.size(), count, x, z, time, height, nx, ny, nz);
+		else if (simd == SimdLevel::SSE)
+			done = waves_sse(components.data(), components.size(), count, x, z, time, height, nx, ny, nz);
+#endif
+
+		waves_scalar(components.data(), components.size(), done, count, x, z, time, height, nx, ny, nz);
+	}
+
+	std::vector<Component> components;
+
+private:
+	SimdLevel simd;
+
+	static void waves_scalar(const Component* waves, size_t wave_count, size_t begin, size_t end,
+	                         const float* x, const float* z, float time, float* height, float* nx, float* ny, float* nz) {
+		for (size_t i = begin; i < end; i++) {
+			float h = 0.0f;
+			float gx = 0.0f;
+			float gz = 0.0f;
+
+			for (size_t w = 0; w < wave_count; w++) {
+				const Component& c = waves[w];
+				float phase = c.frequency * (c.dx * x[i] + c.dz * z[i]) + c.speed * time;
+				float slope = c.amplitude * c.frequency * std::cos(phase);
+
+				h += c.amplitude * std::sin(phase);
+				gx += slope * c.dx;
+				gz += slope * c.dz;
+			}
+
+			height[i] = h;
+
+			if (nx) {
+				// normalize(cross(dP/dz, dP/dx))
+				float inv = 1.0f / std::sqrt(gx * gx + 1.0f + gz * gz);
+				nx[i] = -gx * inv;
+				ny[i] = inv;
+				nz[i] = -gz * inv;
+			}
+		}
+	}
+
+	// Reduction around the nearest multiple of pi, split in three for precision
+	static constexpr float INV_PI = 0.318309886183790671538f;
+	static constexpr float PI_A = 3.140625f;
+	static constexpr float PI_B = 9.67502593994140625e-4f;
+	static constexpr float PI_C = 1.509957990978376432e-7f;
+
+	static constexpr float S1 = -1.0f / 6.0f;
+	static constexpr float S2 = 1.0f / 120.0f;
+	static constexpr float S3 = -1.0f / 5040.0f;
+	static constexpr float S4 = 1.0f / 362880.0f;
+	static constexpr float S5 = -1.0f / 39916800.0f;
+
+	static constexpr float C1 = -1.0f / 2.0f;
+	static constexpr float C2 = 1.0f / 24.0f;
+	static constexpr float C3 = -1.0f / 720.0f;
+	static constexpr float C4 = 1.0f / 40320.0f;
+	static constexpr float C5 = -1.0f / 3628800.0f;
+	static constexpr float C6 = 1.0f / 479001600.0f;
+
+#if SIMD_X86
+	SIMD_TARGET_SSE static void sincos_sse(__m128 x, __m128* s, __m128* c) {
+		__m128i qi = _mm_cvtps_epi32(_mm_mul_ps(x, _mm_set1_ps(INV_PI)));
+		__m128 q = _mm_cvtepi32_ps(qi);
+
+		__m128 r = _mm_sub_ps(x, _mm_mul_ps(q, _mm_set1_ps(PI_A)));
+		r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(PI_B)));
+		r = _mm_sub_ps(r, _mm_mul_ps(q, _mm_set1_ps(PI_C)));
+
+		// sin(r + q pi) = (-1)^q sin(r), same for cos
+		__m128 sign = _mm_castsi128_ps(_mm_slli_epi32(qi, 31));
+
+		__m128 r2 = _mm_mul_ps(r, r);
+
+		__m128 ps = _mm_add_ps(_mm_mul_ps(r2, _mm_set1_ps(S5)), _mm_set1_ps(S4));
+		ps = _mm_add_ps(_mm_mul_ps(r2, ps), _mm_set1_ps(S3));
+		ps = _mm_add_ps(_mm_mul_ps(r2, ps), _mm_set1_ps(S2));
+		ps = _mm_add_ps(_mm_mul_ps(r2, ps), _mm_set1_ps(S1));
+		ps = _mm_add_ps(_mm_mul_ps(_mm_mul_ps(r2, r), ps), r);
+
+		__m128 pc = _mm_add_ps(_mm_mul_ps(r2, _mm_set1_ps(C6)), _mm_set1_ps(C5));
+		pc = _mm_add_ps(_mm_mul_ps(r2, pc), _mm_set1_ps(C4));
+		pc = _mm_add_ps(_mm_mul_ps(r2, pc), _mm_set1_ps(C3));
+		pc = _mm_add_ps(_mm_mul_ps(r2, pc), _mm_set1_ps(C2));
+		pc = _mm_add_ps(_mm_mul_ps(r2, pc), _mm_set1_ps(C1));
+		pc = _mm_add_ps(_mm_mul_ps(r2, pc), _mm_set1_ps(1.0f));
+
+		*s = _mm_xor_ps(ps, sign);
+		*c = _mm_xor_ps(pc, sign);
+	}
+
+	SIMD_TARGET_SSE static size_t waves_sse(const Component* waves, size_t wave_count, size_t count,
+	                                        const float* x, const float* z, float time, float* height, float* nx, float* ny, float* nz) {
+		const size_t end = count & ~size_t(3);
+
+		for (size_t i = 0; i < end; i += 4) {
+			__m128 px = _mm_loadu_ps(x + i);
+			__m128 pz = _mm_loadu_ps(z + i);
+
+			__m128 h = _mm_setzero_ps();
+			__m128 gx = _mm_setzero_ps();
+			__m128 gz = _mm_setzero_ps();
+
+			for (size_t w = 0; w < wave_count; w++) {
+				const Component& c = waves[w];
+
+				__m128 d = _mm_add_ps(_mm_mul_ps(px, _mm_set1_ps(c.dx)), _mm_mul_ps(pz, _mm_set1_ps(c.dz)));
+				__m128 phase = _mm_add_ps(_mm_mul_ps(d, _mm_set1_ps(c.frequency)), _mm_set1_ps(c.speed * time));
+
+				__m128 s, k;
+				sincos_sse(phase, &s, &k);
+
+				__m128 slope = _mm_mul_ps(k, _mm_set1_ps(c.amplitude * c.frequency));
+
+				h = _mm_add_ps(h, _mm_mul_ps(s, _mm_set1_ps(c.amplitude)));
+				gx = _mm_add_ps(gx, _mm_mul_ps(slope, _mm_set1_ps(c.dx)));
+				gz = _mm_add_ps(gz, _mm_mul_ps(slope, _mm_set1_ps(c.dz)));
+			}
+
+			_mm_storeu_ps(height + i, h);
+
+			if (nx) {
+				__m128 length = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(gx, gx), _mm_mul_ps(gz, gz)), _mm_set1_ps(1.0f)));
+				__m128 inv = _mm_div_ps(_mm_set1_ps(1.0f), length);
+				__m128 negative = _mm_set1_ps(-0.0f);
+
+				_mm_storeu_ps(nx + i, _mm_xor_ps(_mm_mul_ps(gx, inv), negative));
+				_mm_storeu_ps(ny + i, inv);
+				_mm_storeu_ps(nz + i, _mm_xor_ps(_mm_mul_ps(gz, inv), negative));
+			}
+		}
+
+		return end;
+	}
+
+	SIMD_TARGET_AVX2 static void sincos_avx2(__m256 x, __m256* s, __m256* c) {
+		__m256 q = _mm256_round_ps(_mm256_mul_ps(x, _mm256_set1_ps(INV_PI)), _MM_FROUND_TO_NEAREST_INT | _MM_FROUND_NO_EXC);
+
+		__m256 r = _mm256_fnmadd_ps(q, _mm256_set1_ps(PI_A), x);
+		r = _mm256_fnmadd_ps(q, _mm256_set1_ps(PI_B), r);
+		r = _mm256_fnmadd_ps(q, _mm256_set1_ps(PI_C), r);
+
+		__m256 sign = _mm256_castsi256_ps(_mm256_slli_epi32(_mm256_cvtps_epi32(q), 31));
+
+		__m256 r2 = _mm256_mul_ps(r, r);
+
+		__m256 ps = _mm256_fmadd_ps(r2, _mm256_set1_ps(S5), _mm256_set1_ps(S4));
+		ps = _mm256_fmadd_ps(r2, ps, _mm256_set1_ps(S3));
+		ps = _mm256_fmadd_ps(r2, ps, _mm256_set1_ps(S2));
+		ps = _mm256_fmadd_ps(r2, ps, _mm256_set1_ps(S1));
+		ps = _mm256_fmadd_ps(_mm256_mul_ps(r2, r), ps, r);
+
+		__m256 pc = _mm256_fmadd_ps(r2, _mm256_set1_ps(C6), _mm256_set1_ps(C5));
+		pc = _mm256_fmadd_ps(r2, pc, _mm256_set1_ps(C4));
+		pc = _mm256_fmadd_ps(r2, pc, _mm256_set1_ps(C3));
+		pc = _mm256_fmadd_ps(r2, pc, _mm256_set1_ps(C2));
+		pc = _mm256_fmadd_ps(r2, pc, _mm256_set1_ps(C1));
+		pc = _mm256_fmadd_ps(r2, pc, _mm256_set1_ps(1.0f));
+
+		*s = _mm256_xor_ps(ps, sign);
+		*c = _mm256_xor_ps(pc, sign);
+	}
+
+	SIMD_TARGET_AVX2 static size_t waves_avx2(const Component* waves, size_t wave_count, size_t count,
+	                                          const float* x, const float* z, float time, float* height, float* nx, float* ny, float* nz) {
+		const size_t end = count & ~size_t(7);
+
+		for (size_t i = 0; i < end; i += 8) {
+			__m256 px = _mm256_loadu_ps(x + i);
+			__m256 pz = _mm256_loadu_ps(z + i);
+
+			__m256 h = _mm256_setzero_ps();
+			__m256 gx = _mm256_setzero_ps();
+			__m256 gz = _mm256_setzero_ps();
+
+			for (size_t w = 0; w < wave_count; w++) {
+				const Component& c = waves[w];
+
+				__m256 d = _mm256_fmadd_ps(px, _mm256_set1_ps(c.dx), _mm256_mul_ps(pz, _mm256_set1_ps(c.dz)));
+				__m256 phase = _mm256_fmadd_ps(d, _mm256_set1_ps(c.frequency), _mm256_set1_ps(c.speed * time));
+
+				__m256 s, k;
+				sincos_avx2(phase, &s, &k);
+
+				__m256 slope = _mm256_mul_ps(k, _mm256_set1_ps(c.amplitude * c.frequency));
+
+				h = _mm256_fmadd_ps(s, _mm256_set1_ps(c.amplitude), h);
+				gx = _mm256_fmadd_ps(slope, _mm256_set1_ps(c.dx), gx);
+				gz = _mm256_fmadd_ps(slope, _mm256_set1_ps(c.dz), gz);
+			}
+
+			_mm256_storeu_ps(height + i, h);
+
+			if (nx) {
+				__m256 length = _mm256_sqrt_ps(_mm256_fmadd_ps(gx, gx, _mm256_fmadd_ps(gz, gz, _mm256_set1_ps(1.0f))));
+				__m256 inv = _mm256_div_ps(_mm256_set1_ps(1.0f), length);
+				__m256 negative = _mm256_set1_ps(-0.0f);
+
+				_mm256_storeu_ps(nx + i, _mm256_xor_ps(_mm256_mul_ps(gx, inv), negative));
+				_mm256_storeu_ps(ny + i, inv);
+				_mm256_storeu_ps(nz + i, _mm256_xor_ps(_mm256_mul_ps(gz, inv), negative));
+			}
+		}
+
+		return end;
+	}
+#endif
+};